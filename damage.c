@@ -0,0 +1,226 @@
+#include "damage.h"
+
+#include <string.h>
+
+static inline int min(int x, int y) { return x < y ? x : y; }
+static inline int max(int x, int y) { return x > y ? x : y; }
+
+static EpdRect rect_union(EpdRect a, EpdRect b)
+{
+    int x1 = min(a.x, b.x);
+    int y1 = min(a.y, b.y);
+    int x2 = max(a.x + a.width, b.x + b.width);
+    int y2 = max(a.y + a.height, b.y + b.height);
+
+    EpdRect u = {
+        .x = x1,
+        .y = y1,
+        .width = x2 - x1,
+        .height = y2 - y1
+    };
+    return u;
+}
+
+static int rect_touches(EpdRect a, EpdRect b)
+{
+    return a.x <= b.x + b.width && b.x <= a.x + a.width
+        && a.y <= b.y + b.height && b.y <= a.y + a.height;
+}
+
+static int rect_area(EpdRect r)
+{
+    return r.width * r.height;
+}
+
+void damage_init(DamageList *damage)
+{
+    damage->count = 0;
+}
+
+void damage_add(DamageList *damage, EpdRect rect)
+{
+    if (rect.width <= 0 || rect.height <= 0) {
+        return;
+    }
+
+    // merging might make the grown rect touch other rects, so keep going until stable
+    int i = 0;
+    while (i < damage->count) {
+        if (rect_touches(damage->rects[i], rect)) {
+            rect = rect_union(damage->rects[i], rect);
+            damage->rects[i] = damage->rects[damage->count - 1];
+            damage->count--;
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (damage->count < DAMAGE_MAX_RECTS) {
+        damage->rects[damage->count] = rect;
+        damage->count++;
+        return;
+    }
+
+    int best = 0;
+    int best_growth = -1;
+    for (int j = 0; j < damage->count; j++) {
+        int growth = rect_area(rect_union(damage->rects[j], rect)) - rect_area(damage->rects[j]);
+        if (best_growth < 0 || growth < best_growth) {
+            best = j;
+            best_growth = growth;
+        }
+    }
+
+    EpdRect merged = rect_union(damage->rects[best], rect);
+    damage->rects[best] = damage->rects[damage->count - 1];
+    damage->count--;
+    damage_add(damage, merged);
+}
+
+void damage_scan_area(DamageList *damage, const uint8_t *front, const uint8_t *back, int width,
+    EpdRect area)
+{
+    int line_bytes = width / 2;
+    int start_byte = area.x / 2;
+    int end_byte = (area.x + area.width + 1) / 2;
+    int area_bytes = end_byte - start_byte;
+    int end_y = area.y + area.height;
+
+    if (area_bytes <= 0) {
+        return;
+    }
+
+    int band_start = -1;
+    int band_min_byte = end_byte;
+    int band_max_byte = -1;
+
+    for (int y = area.y; y <= end_y; y++) {
+        int first = -1;
+        int last = -1;
+
+        if (y < end_y) {
+            const uint8_t *f = front + y * line_bytes;
+            const uint8_t *b = back + y * line_bytes;
+            if (memcmp(f + start_byte, b + start_byte, area_bytes)) {
+                first = start_byte;
+                while (f[first] == b[first]) {
+                    first++;
+                }
+                last = end_byte - 1;
+                while (f[last] == b[last]) {
+                    last--;
+                }
+            }
+        }
+
+        if (first >= 0) {
+            if (band_start < 0) {
+                band_start = y;
+            }
+            band_min_byte = min(band_min_byte, first);
+            band_max_byte = max(band_max_byte, last);
+
+        } else if (band_start >= 0) {
+            EpdRect band = {
+                .x = band_min_byte * 2,
+                .y = band_start,
+                .width = (band_max_byte - band_min_byte + 1) * 2,
+                .height = y - band_start
+            };
+            damage_add(damage, band);
+
+            band_start = -1;
+            band_min_byte = end_byte;
+            band_max_byte = -1;
+        }
+    }
+}
+
+// FNV-1a over 32 bit words
+static uint64_t hash_tile(const uint8_t *framebuffer, int tx, int ty)
+{
+    int line_bytes = EPD_WIDTH / 2;
+    int x = tx * DAMAGE_TILE_SIZE;
+    int y = ty * DAMAGE_TILE_SIZE;
+    int bytes = (min(x + DAMAGE_TILE_SIZE, EPD_WIDTH) - x) / 2;
+    int end_y = min(y + DAMAGE_TILE_SIZE, EPD_HEIGHT);
+
+    uint64_t hash = 14695981039346656037u;
+    for (int row = y; row < end_y; row++) {
+        const uint8_t *line = framebuffer + row * line_bytes + x / 2;
+        int i = 0;
+        for (; i + 4 <= bytes; i += 4) {
+            uint32_t word;
+            memcpy(&word, line + i, 4);
+            hash = (hash ^ word) * 1099511628211u;
+        }
+        for (; i < bytes; i++) {
+            hash = (hash ^ line[i]) * 1099511628211u;
+        }
+    }
+    return hash;
+}
+
+void damage_tiles_init(DamageTiles *tiles, const uint8_t *framebuffer)
+{
+    for (int ty = 0; ty < DAMAGE_TILES_Y; ty++) {
+        for (int tx = 0; tx < DAMAGE_TILES_X; tx++) {
+            tiles->hashes[ty][tx] = hash_tile(framebuffer, tx, ty);
+        }
+    }
+}
+
+int damage_scan_tiles(DamageList *damage, DamageTiles *tiles, const uint8_t *framebuffer,
+    const DamageList *areas)
+{
+    // a tile can be covered by several areas, hash it only once
+    enum
+    {
+        TILE_NOT_HASHED,
+        TILE_UNCHANGED,
+        TILE_CHANGED
+    };
+    uint8_t state[DAMAGE_TILES_Y][DAMAGE_TILES_X];
+    memset(state, TILE_NOT_HASHED, sizeof(state));
+
+    int dirty = 0;
+    for (int a = 0; a < areas->count; a++) {
+        EpdRect area = areas->rects[a];
+        if (area.width <= 0 || area.height <= 0) {
+            continue;
+        }
+
+        for (int ty = area.y / DAMAGE_TILE_SIZE; ty <= (area.y + area.height - 1) / DAMAGE_TILE_SIZE; ty++) {
+            for (int tx = area.x / DAMAGE_TILE_SIZE; tx <= (area.x + area.width - 1) / DAMAGE_TILE_SIZE; tx++) {
+                if (state[ty][tx] == TILE_NOT_HASHED) {
+                    uint64_t hash = hash_tile(framebuffer, tx, ty);
+                    if (hash != tiles->hashes[ty][tx]) {
+                        tiles->hashes[ty][tx] = hash;
+                        state[ty][tx] = TILE_CHANGED;
+                        dirty++;
+                    } else {
+                        state[ty][tx] = TILE_UNCHANGED;
+                    }
+                }
+                if (state[ty][tx] == TILE_UNCHANGED) {
+                    continue;
+                }
+
+                int x1 = max(area.x, tx * DAMAGE_TILE_SIZE);
+                int y1 = max(area.y, ty * DAMAGE_TILE_SIZE);
+                int x2 = min(area.x + area.width, (tx + 1) * DAMAGE_TILE_SIZE);
+                int y2 = min(area.y + area.height, (ty + 1) * DAMAGE_TILE_SIZE);
+                EpdRect part = {
+                    .x = x1,
+                    .y = y1,
+                    .width = x2 - x1,
+                    .height = y2 - y1
+                };
+                damage_add(damage, part);
+            }
+        }
+    }
+
+    return dirty;
+}
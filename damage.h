@@ -0,0 +1,60 @@
+#ifndef _DAMAGE_H_
+#define _DAMAGE_H_
+
+#include <stdint.h>
+
+#include <epd_driver.h>
+
+#define DAMAGE_MAX_RECTS 8
+
+#define DAMAGE_TILE_SIZE 64
+#define DAMAGE_TILES_X ((EPD_WIDTH + DAMAGE_TILE_SIZE - 1) / DAMAGE_TILE_SIZE)
+#define DAMAGE_TILES_Y ((EPD_HEIGHT + DAMAGE_TILE_SIZE - 1) / DAMAGE_TILE_SIZE)
+
+/**
+ * A small set of screen areas that have to be pushed to the panel.
+ *
+ * Rects never overlap: adding a rect that touches an existing one merges
+ * them, and once DAMAGE_MAX_RECTS is reached new rects are merged into the
+ * rect that grows the least.
+ */
+typedef struct
+{
+    EpdRect rects[DAMAGE_MAX_RECTS];
+    int count;
+} DamageList;
+
+/**
+ * Content hashes of the DAMAGE_TILE_SIZE tiles of a EPD_WIDTH x EPD_HEIGHT
+ * 4bpp framebuffer.
+ */
+typedef struct
+{
+    uint64_t hashes[DAMAGE_TILES_Y][DAMAGE_TILES_X];
+} DamageTiles;
+
+void damage_init(DamageList *damage);
+void damage_add(DamageList *damage, EpdRect rect);
+
+/**
+ * Compare the lines and byte columns of area in two 4bpp framebuffers of
+ * the given width, and add the bounding box of every run of changed lines
+ * to damage.
+ */
+void damage_scan_area(DamageList *damage, const uint8_t *front, const uint8_t *back, int width,
+    EpdRect area);
+
+/**
+ * Hash every tile of framebuffer.
+ */
+void damage_tiles_init(DamageTiles *tiles, const uint8_t *framebuffer);
+
+/**
+ * Hash again the tiles of framebuffer overlapping areas and add the parts
+ * of areas that are on tiles whose hash changed to damage.
+ * Returns the number of changed tiles.
+ */
+int damage_scan_tiles(DamageList *damage, DamageTiles *tiles, const uint8_t *framebuffer,
+    const DamageList *areas);
+
+#endif
@@ -1,7 +1,10 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <context.h>
 #include <defaultatoms.h>
+#include <esp32_sys.h>
 #include <interop.h>
 #include <mailbox.h>
 #include <term.h>
@@ -10,192 +13,1280 @@
 #include <epd_driver.h>
 #include <epd_highlevel.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#include "damage.h"
+#include "raster.h"
+#include "refresh.h"
 #include "ufontlib.h"
 #include "default16px_font.h"
 
 static void consume_display_mailbox(Context *ctx);
 
+// Counters for the last update (updates is a running total, the refresh_ fields and the panel
+// power totals are from the last completed refresh), returned by the stats call as small
+// integers: a 32 bit AtomVM has 28 bits for them, so powered_ms saturates after about 37 hours
+struct RenderStats
+{
+    uint32_t updates;
+    uint32_t commands;
+    uint32_t pixels;
+    uint32_t dirty_tiles;
+    uint32_t glyphs;
+    uint32_t allocs;
+    uint32_t glyph_cache_hits;
+    uint32_t glyph_cache_misses;
+    uint32_t layout_cache_hits;
+    uint32_t layout_cache_misses;
+    uint32_t raster_us;
+    uint32_t refresh_us;
+    // damaged areas pushed to the panel, 1 in refresh_clean when the ghosting budget forced a full GC16
+    uint32_t refresh_areas;
+    uint32_t refresh_clean;
+    uint32_t power_ons;
+    uint32_t powered_ms;
+};
+
+#define RENDER_STATS_ITEMS 16
+#define RENDER_STATS_TERM_SIZE (RENDER_STATS_ITEMS * (TUPLE_SIZE(2) + CONS_SIZE))
+
+// Protocol atoms, grouped so that each kind of lookup is a contiguous range
+enum DisplayAtom
+{
+    // display list commands
+    ATOM_IMAGE,
+    ATOM_RECT,
+    ATOM_FILL_RECT,
+    ATOM_TEXT,
+
+    // image formats
+    ATOM_RGBA8888,
+    ATOM_GRAY4,
+    ATOM_GRAY8,
+
+    // refresh modes
+    ATOM_AUTO,
+    ATOM_DU,
+    ATOM_GL16,
+    ATOM_GC16,
+
+    // calls
+    ATOM_UPDATE,
+    ATOM_DRAW,
+    ATOM_FLUSH,
+    ATOM_REGISTER_FONT,
+    ATOM_STATS,
+
+    // stats keys, in struct RenderStats order
+    ATOM_UPDATES,
+    ATOM_COMMANDS,
+    ATOM_PIXELS,
+    ATOM_DIRTY_TILES,
+    ATOM_GLYPHS,
+    ATOM_ALLOCS,
+    ATOM_GLYPH_CACHE_HITS,
+    ATOM_GLYPH_CACHE_MISSES,
+    ATOM_LAYOUT_CACHE_HITS,
+    ATOM_LAYOUT_CACHE_MISSES,
+    ATOM_RASTER_US,
+    ATOM_REFRESH_US,
+    ATOM_REFRESH_AREAS,
+    ATOM_REFRESH_CLEAN,
+    ATOM_POWER_ONS,
+    ATOM_POWERED_MS,
+
+    // port options
+    ATOM_ROTATION,
+    ATOM_REFRESH_MODE,
+    ATOM_CLEAR_ON_START,
+    ATOM_GLYPH_CACHE_SIZE,
+    ATOM_LAYOUT_CACHE_SIZE,
+    ATOM_FRAMEBUFFER,
+    ATOM_PSRAM,
+    ATOM_INTERNAL,
+    ATOM_GHOSTING_BUDGET,
+    ATOM_IDLE_TIMEOUT_MS,
+
+    ATOM_DEFAULT16PX,
+    ATOM_ALL,
+    ATOM_CALL,
+    ATOM_REPLY,
+
+    DISPLAY_ATOMS_COUNT
+};
+
+_Static_assert(ATOM_POWERED_MS - ATOM_UPDATES + 1 == RENDER_STATS_ITEMS, "one stats key per RenderStats field");
+
+#define FIRST_LIST_COMMAND_ATOM ATOM_IMAGE
+#define LAST_LIST_COMMAND_ATOM ATOM_TEXT
+#define FIRST_IMAGE_FORMAT_ATOM ATOM_RGBA8888
+#define LAST_IMAGE_FORMAT_ATOM ATOM_GRAY8
+#define FIRST_REFRESH_MODE_ATOM ATOM_AUTO
+#define LAST_REFRESH_MODE_ATOM ATOM_GC16
+#define FIRST_CALL_ATOM ATOM_UPDATE
+#define LAST_CALL_ATOM ATOM_STATS
+
+static const char *const display_atom_names[DISPLAY_ATOMS_COUNT] = {
+    [ATOM_IMAGE] = "\x5" "image",
+    [ATOM_RECT] = "\x4" "rect",
+    [ATOM_FILL_RECT] = "\x9" "fill_rect",
+    [ATOM_TEXT] = "\x4" "text",
+    [ATOM_RGBA8888] = "\x8" "rgba8888",
+    [ATOM_GRAY4] = "\x5" "gray4",
+    [ATOM_GRAY8] = "\x5" "gray8",
+    [ATOM_AUTO] = "\x4" "auto",
+    [ATOM_DU] = "\x2" "du",
+    [ATOM_GL16] = "\x4" "gl16",
+    [ATOM_GC16] = "\x4" "gc16",
+    [ATOM_UPDATE] = "\x6" "update",
+    [ATOM_DRAW] = "\x4" "draw",
+    [ATOM_FLUSH] = "\x5" "flush",
+    [ATOM_REGISTER_FONT] = "\xD" "register_font",
+    [ATOM_STATS] = "\x5" "stats",
+    [ATOM_UPDATES] = "\x7" "updates",
+    [ATOM_COMMANDS] = "\x8" "commands",
+    [ATOM_PIXELS] = "\x6" "pixels",
+    [ATOM_DIRTY_TILES] = "\xB" "dirty_tiles",
+    [ATOM_GLYPHS] = "\x6" "glyphs",
+    [ATOM_ALLOCS] = "\x6" "allocs",
+    [ATOM_GLYPH_CACHE_HITS] = "\x10" "glyph_cache_hits",
+    [ATOM_GLYPH_CACHE_MISSES] = "\x12" "glyph_cache_misses",
+    [ATOM_LAYOUT_CACHE_HITS] = "\x11" "layout_cache_hits",
+    [ATOM_LAYOUT_CACHE_MISSES] = "\x13" "layout_cache_misses",
+    [ATOM_RASTER_US] = "\x9" "raster_us",
+    [ATOM_REFRESH_US] = "\xA" "refresh_us",
+    [ATOM_REFRESH_AREAS] = "\xD" "refresh_areas",
+    [ATOM_REFRESH_CLEAN] = "\xD" "refresh_clean",
+    [ATOM_POWER_ONS] = "\x9" "power_ons",
+    [ATOM_POWERED_MS] = "\xA" "powered_ms",
+    [ATOM_ROTATION] = "\x8" "rotation",
+    [ATOM_REFRESH_MODE] = "\xC" "refresh_mode",
+    [ATOM_CLEAR_ON_START] = "\xE" "clear_on_start",
+    [ATOM_GLYPH_CACHE_SIZE] = "\x10" "glyph_cache_size",
+    [ATOM_LAYOUT_CACHE_SIZE] = "\x11" "layout_cache_size",
+    [ATOM_FRAMEBUFFER] = "\xB" "framebuffer",
+    [ATOM_PSRAM] = "\x5" "psram",
+    [ATOM_INTERNAL] = "\x8" "internal",
+    [ATOM_GHOSTING_BUDGET] = "\xF" "ghosting_budget",
+    [ATOM_IDLE_TIMEOUT_MS] = "\xF" "idle_timeout_ms",
+    [ATOM_DEFAULT16PX] = "\xB" "default16px",
+    [ATOM_ALL] = "\x3" "all",
+    [ATOM_CALL] = "\x5" "$call",
+    [ATOM_REPLY] = "\x6" "$reply"
+};
+
+// A caller of update waiting for its display list to be on the panel
+struct PendingReply
+{
+    struct ListHead head;
+    int local_process_id;
+    uint64_t ref_ticks;
+};
+
+// An item of the last display list, see diff_display_list
+struct DisplayItem
+{
+    uint64_t hash;
+    EpdRect bbox;
+    // where the raster threads count the item in the stats during do_update, see first_band
+    int first_band;
+};
+
+// Damaged areas are drawn in bands of rows, shared round-robin between one thread per core
+#define RASTER_BAND_HEIGHT 64
+#define RASTER_BANDS ((EPD_HEIGHT + RASTER_BAND_HEIGHT - 1) / RASTER_BAND_HEIGHT)
+#define RASTER_THREADS portNUM_PROCESSORS
+#define RASTER_TASK_STACK_SIZE 8192
+#define RASTER_TASK_PRIORITY 4
+
+// What the raster threads draw during do_update
+struct RasterJob
+{
+    Context *ctx;
+    const term *items;
+    const struct DisplayItem *display_items;
+    int len;
+    const DamageList *damage;
+};
+
+// A raster thread other than the one running the port, see raster_task
+struct RasterWorker
+{
+    struct DisplayData *data;
+    int thread;
+    SemaphoreHandle_t start;
+    SemaphoreHandle_t done;
+    struct RenderStats stats;
+};
+
+struct DisplayData
+{
+    EpdiyHighlevelState hl;
+    // display lists are drawn here, and copied to hl.front_fb when the refresh worker is idle
+    uint8_t *draw_fb;
+    // clockwise rotation of the display list and flush area coordinates, in degrees
+    int rotation;
+    // used by update and flush calls that do not ask for a refresh mode
+    enum RefreshMode default_mode;
+    RefreshWorker refresh;
+    EventListener refresh_listener;
+    bool refresh_running;
+    // a flush is waiting for the refresh worker, flush_area is the union of the requested areas
+    bool flush_pending;
+    EpdRect flush_area;
+    enum RefreshMode flush_mode;
+    // areas of draw_fb that changed since it was last copied to hl.front_fb
+    DamageList frame_damage;
+    // hashes of the tiles of draw_fb, to find which parts of the damage really changed
+    DamageTiles tiles;
+    struct ListHead pending_replies;
+    struct ListHead running_replies;
+    // the last display list, in drawing order
+    struct DisplayItem *items;
+    int items_count;
+    // false when draw_fb does not match items, e.g. a font was registered again
+    bool items_valid;
+    struct RasterJob raster_job;
+    // raster_workers[0] is unused, the port itself draws the bands of thread 0
+    struct RasterWorker raster_workers[RASTER_THREADS];
+    struct RenderStats stats;
+    term atoms[DISPLAY_ATOMS_COUNT];
+};
+
+/*
+ * Find which of the atoms in [first, last] t is, returns -1 when it is none of them.
+ */
+static int display_atom_lookup(const struct DisplayData *data, term t, enum DisplayAtom first, enum DisplayAtom last)
+{
+    for (int i = first; i <= last; i++) {
+        if (data->atoms[i] == t) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 UFontManager *ufont_manager;
 
+// ufontlib draws to a RasterTarget, passed as its framebuffer
 void ufont_draw_pixel(int x, int y, uint8_t color, void *framebuffer)
 {
-    epd_draw_pixel(x, y, color, framebuffer);
+    raster_draw_pixel((const RasterTarget *) framebuffer, x, y, color >> 4);
 }
 
-inline static float luma_rec709(uint8_t r, uint8_t g, uint8_t b)
+void ufont_draw_bitmap(int x, int y, int width, int height, const uint8_t *bitmap,
+    const uint8_t *color_lut, bool opaque, void *framebuffer)
 {
-    return 0.2126f * (float) r + 0.7152f * (float) g + 0.0722f * (float) b;
+    raster_blend_glyph((const RasterTarget *) framebuffer, x, y, width, height, bitmap, color_lut, opaque);
 }
 
-inline static uint8_t grey(uint8_t r, uint8_t g, uint8_t b)
+void ufont_draw_hline(int x, int y, int length, uint8_t color, void *framebuffer)
 {
-    return (uint8_t)(luma_rec709(r, g, b) + 0.5F);
+    raster_fill_hline((const RasterTarget *) framebuffer, x, y, length, color >> 4);
 }
 
-static void draw_image(uint8_t *framebuffer, int x, int y, int width, int height, const char *data, uint8_t r, uint8_t g, uint8_t b)
+enum ImageFormat
+{
+    IMAGE_FORMAT_RGBA8888,
+    IMAGE_FORMAT_GRAY4,
+    IMAGE_FORMAT_GRAY8
+};
+
+/*
+ * Bytes of data of a width x height image. Returns false when the size is
+ * negative or too large to be addressed.
+ */
+static bool image_data_size(enum ImageFormat format, int width, int height, size_t *size)
 {
-    uint32_t *pixels = (uint32_t *) data;
+    if (width < 0 || height < 0) {
+        return false;
+    }
 
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            uint8_t color;
-            if ((*pixels >> 24) & 0xFF) {
-                color = grey((*pixels) & 0xFF, (*pixels >> 8) & 0xFF, (*pixels >> 16) & 0xFF);
-            } else {
-                color = grey(0xFF, 0xFF, 0xFF);
-            }
-            epd_draw_pixel(x + j, y + i, color, framebuffer);
-            pixels++;
-        }
+    // both factors are below 2^31, so none of these can overflow 64 bits
+    uint64_t bytes = 0;
+    switch (format) {
+        case IMAGE_FORMAT_RGBA8888:
+            bytes = (uint64_t) width * height * 4;
+            break;
+        case IMAGE_FORMAT_GRAY4:
+            bytes = ((uint64_t) width + 1) / 2 * height;
+            break;
+        case IMAGE_FORMAT_GRAY8:
+            bytes = (uint64_t) width * height;
+            break;
+    }
+    if (bytes > SIZE_MAX) {
+        return false;
+    }
+
+    *size = bytes;
+    return true;
+}
+
+// Returns false when format is not one of the image format atoms
+static bool image_format_from_term(const struct DisplayData *data, term format, enum ImageFormat *image_format)
+{
+    switch (display_atom_lookup(data, format, FIRST_IMAGE_FORMAT_ATOM, LAST_IMAGE_FORMAT_ATOM)) {
+        case ATOM_RGBA8888:
+            *image_format = IMAGE_FORMAT_RGBA8888;
+            return true;
+        case ATOM_GRAY4:
+            *image_format = IMAGE_FORMAT_GRAY4;
+            return true;
+        case ATOM_GRAY8:
+            *image_format = IMAGE_FORMAT_GRAY8;
+            return true;
+        default:
+            return false;
     }
 }
 
-static void draw_rect(uint8_t *framebuffer, int x, int y, int width, int height, uint8_t r, uint8_t g, uint8_t b)
+static void draw_image(const RasterTarget *target, int x, int y, int width, int height, enum ImageFormat format,
+    const char *data, uint8_t r, uint8_t g, uint8_t b)
 {
-    EpdRect rect = {
-        .x = x,
-        .y = y,
-        .width = width,
-        .height = height
-    };
-    epd_draw_rect(rect, grey(r, g, b), framebuffer);
+    switch (format) {
+        case IMAGE_FORMAT_RGBA8888:
+            raster_blit_rgba8888(target, x, y, width, height, (const uint8_t *) data);
+            break;
+        case IMAGE_FORMAT_GRAY4:
+            raster_blit_gray4(target, x, y, width, height, (const uint8_t *) data);
+            break;
+        case IMAGE_FORMAT_GRAY8:
+            raster_blit_gray8(target, x, y, width, height, (const uint8_t *) data);
+            break;
+    }
+}
+
+static void draw_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t r, uint8_t g, uint8_t b)
+{
+    raster_draw_rect(target, x, y, width, height, gray4(r, g, b));
+}
+
+static void fill_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t r, uint8_t g, uint8_t b)
+{
+    raster_fill_rect(target, x, y, width, height, gray4(r, g, b));
+}
+
+/*
+ * Font properties for a 0xRRGGBB text color, bgcolor is either a 0xRRGGBB
+ * color filling the text box or a negative value for a transparent background.
+ */
+static UFontFontProperties text_properties(uint32_t fgcolor, int bgcolor)
+{
+    UFontFontProperties props = ufont_font_properties_default();
+    props.fg_color = gray4((fgcolor >> 16) & 0xFF, (fgcolor >> 8) & 0xFF, fgcolor & 0xFF);
+    if (bgcolor >= 0) {
+        props.bg_color = gray4((bgcolor >> 16) & 0xFF, (bgcolor >> 8) & 0xFF, bgcolor & 0xFF);
+        props.flags |= UFONT_DRAW_BACKGROUND;
+    }
+    return props;
 }
 
-static void draw_text(uint8_t *framebuffer, int x, int y, const UFontData *font, const char *text,
-    uint8_t r, uint8_t g, uint8_t b, uint8_t bgr, uint8_t bgg, uint8_t bgb)
+// any non integer background, such as transparent, leaves the background untouched
+static int text_bgcolor(term bgcolor)
+{
+    return term_is_integer(bgcolor) ? (term_to_int(bgcolor) & 0xFFFFFF) : -1;
+}
+
+static void draw_text(const RasterTarget *target, int x, int y, const UFontData *font, const char *text,
+    const UFontFontProperties *props, UFontStats *font_stats)
 {
     if (!font) {
         int len = strlen(text);
-        uint8_t color = grey(r, g, b);
+        int bg = props->flags & UFONT_DRAW_BACKGROUND ? props->bg_color : -1;
 
         for (int i = 0; i < len; i++) {
             unsigned const char *glyph = fontdata + ((unsigned char) text[i]) * 16;
-
-            for (int j = 0; j < 16; j++) {
-                unsigned char row = glyph[j];
-
-                for (int k = 0; k < 8; k++) {
-                    if (row & (1 << (7 - k))) {
-                        epd_draw_pixel(x + i * 8 + k, y + j, color, framebuffer);
-                    }
-                }
-            }
+            raster_draw_mono8_glyph(target, x + i * 8, y, glyph, 16, props->fg_color, bg);
         }
     } else {
         y += font->ascender;
-        ufont_write_default(font, text, &x, &y, framebuffer);
+        ufont_write_string_with_stats(font, text, &x, &y, (void *) target, props, font_stats);
     }
 }
 
-static void execute_command(Context *ctx, term req)
+/*
+ * Find the font of a text command, NULL is the built-in font.
+ * Returns false when there is no font with that name.
+ */
+static bool find_font(const struct DisplayData *data, term font_name, const UFontData **font)
 {
-    uint8_t *framebuffer = epd_hl_get_framebuffer((EpdiyHighlevelState *) ctx->platform_data);
+    *font = NULL;
+    if (font_name == data->atoms[ATOM_DEFAULT16PX]) {
+        return true;
+    }
+
+    *font = ufont_manager_find_by_id(ufont_manager, term_to_atom_index(font_name));
+    return *font != NULL;
+}
+
+static void add_font_stats(struct RenderStats *stats, const UFontStats *font_stats)
+{
+    stats->glyphs += font_stats->glyphs_drawn;
+    stats->allocs += font_stats->allocs;
+    stats->glyph_cache_hits += font_stats->glyph_cache_hits;
+    stats->glyph_cache_misses += font_stats->glyph_cache_misses;
+    stats->layout_cache_hits += font_stats->layout_cache_hits;
+    stats->layout_cache_misses += font_stats->layout_cache_misses;
+}
+
+/*
+ * Draw one display list item into target. Items are validated by item_bbox, invalid
+ * ones have an empty bbox and never get here. An item is drawn again in every band it
+ * overlaps: its pixels and glyphs are only added to stats when counted, while
+ * allocations and font cache activity are added for every band, so that the totals
+ * do not depend on which thread reaches a glyph first.
+ */
+static void execute_command(Context *ctx, term req, const RasterTarget *target, bool counted, struct RenderStats *stats)
+{
+    struct DisplayData *data = ctx->platform_data;
 
     term cmd = term_get_tuple_element(req, 0);
 
-    if (cmd == context_make_atom(ctx, "\x5"
-                                      "image")) {
-        int x = term_to_int(term_get_tuple_element(req, 1));
-        int y = term_to_int(term_get_tuple_element(req, 2));
-        int bgcolor = term_to_int(term_get_tuple_element(req, 3));
-        term img = term_get_tuple_element(req, 4);
+    switch (display_atom_lookup(data, cmd, FIRST_LIST_COMMAND_ATOM, LAST_LIST_COMMAND_ATOM)) {
+        case ATOM_IMAGE: {
+            int x = term_to_int(term_get_tuple_element(req, 1));
+            int y = term_to_int(term_get_tuple_element(req, 2));
+            int bgcolor = term_to_int(term_get_tuple_element(req, 3));
+            term img = term_get_tuple_element(req, 4);
+
+            enum ImageFormat image_format;
+            if (!image_format_from_term(data, term_get_tuple_element(img, 0), &image_format)) {
+                return;
+            }
+
+            int width = term_to_int(term_get_tuple_element(img, 1));
+            int height = term_to_int(term_get_tuple_element(img, 2));
+            term pixels_bin = term_get_tuple_element(img, 3);
 
-        term format = term_get_tuple_element(img, 0);
+            const char *pixels = term_binary_data(pixels_bin);
 
-        if (format != context_make_atom(ctx, "\x8"
-                                             "rgba8888")) {
-            fprintf(stderr, "warning: invalid image format: ");
-            term_display(stderr, format, ctx);
-            fprintf(stderr, "\n");
-            return;
+            draw_image(target, x, y, width, height, image_format, pixels, (bgcolor >> 16),
+                (bgcolor >> 8) & 0xFF, bgcolor & 0xFF);
+            if (counted) {
+                stats->pixels += width * height;
+            }
+            break;
         }
 
-        int width = term_to_int(term_get_tuple_element(img, 1));
-        int height = term_to_int(term_get_tuple_element(img, 2));
-        const char *data = term_binary_data(term_get_tuple_element(img, 3));
-
-        draw_image(framebuffer, x, y, width, height, data, (bgcolor >> 16),
-            (bgcolor >> 8) & 0xFF, bgcolor & 0xFF);
-
-    } else if (cmd == context_make_atom(ctx, "\x4"
-                                             "rect")) {
-        int x = term_to_int(term_get_tuple_element(req, 1));
-        int y = term_to_int(term_get_tuple_element(req, 2));
-        int width = term_to_int(term_get_tuple_element(req, 3));
-        int height = term_to_int(term_get_tuple_element(req, 4));
-        int color = term_to_int(term_get_tuple_element(req, 5));
-
-        draw_rect(framebuffer, x, y, width, height,
-            (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
-
-    } else if (cmd == context_make_atom(ctx, "\x4"
-                                             "text")) {
-        int x = term_to_int(term_get_tuple_element(req, 1));
-        int y = term_to_int(term_get_tuple_element(req, 2));
-        term font_name = term_get_tuple_element(req, 3);
-        uint32_t fgcolor = term_to_int(term_get_tuple_element(req, 4));
-        uint32_t bgcolor = term_get_tuple_element(req, 5);
-        term text_term = term_get_tuple_element(req, 6);
-
-        int ok;
-        char *text = interop_term_to_string(text_term, &ok);
-
-        const UFontData *loaded_font = NULL;
-        if (font_name != context_make_atom(ctx, "\xB"
-                                                "default16px")) {
-            AtomString handle_atom = globalcontext_atomstring_from_term(ctx->global, font_name);
-            char handle[255];
-            atom_string_to_c(handle_atom, handle, sizeof(handle));
-            loaded_font = ufont_manager_find_by_handle(ufont_manager, handle);
+        case ATOM_RECT: {
+            int x = term_to_int(term_get_tuple_element(req, 1));
+            int y = term_to_int(term_get_tuple_element(req, 2));
+            int width = term_to_int(term_get_tuple_element(req, 3));
+            int height = term_to_int(term_get_tuple_element(req, 4));
+            int color = term_to_int(term_get_tuple_element(req, 5));
+
+            draw_rect(target, x, y, width, height,
+                (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+            if (counted) {
+                stats->pixels += 2 * (width + height);
+            }
+            break;
+        }
+
+        case ATOM_FILL_RECT: {
+            int x = term_to_int(term_get_tuple_element(req, 1));
+            int y = term_to_int(term_get_tuple_element(req, 2));
+            int width = term_to_int(term_get_tuple_element(req, 3));
+            int height = term_to_int(term_get_tuple_element(req, 4));
+            int color = term_to_int(term_get_tuple_element(req, 5));
+
+            fill_rect(target, x, y, width, height,
+                (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF);
+            if (counted) {
+                stats->pixels += width * height;
+            }
+            break;
+        }
+
+        case ATOM_TEXT: {
+            int x = term_to_int(term_get_tuple_element(req, 1));
+            int y = term_to_int(term_get_tuple_element(req, 2));
+            term font_name = term_get_tuple_element(req, 3);
+            uint32_t fgcolor = term_to_int(term_get_tuple_element(req, 4));
+            int bgcolor = text_bgcolor(term_get_tuple_element(req, 5));
+            term text_term = term_get_tuple_element(req, 6);
+
+            const UFontData *loaded_font;
+            if (!find_font(data, font_name, &loaded_font)) {
+                return;
+            }
+
+            int ok;
+            char *text = interop_term_to_string(text_term, &ok);
+            stats->allocs++;
+            if (!text) {
+                return;
+            }
+
+            UFontFontProperties props = text_properties(fgcolor, bgcolor);
+            UFontStats font_stats;
+            memset(&font_stats, 0, sizeof(font_stats));
+            draw_text(target, x, y, loaded_font, text, &props, &font_stats);
+            if (counted) {
+                stats->glyphs += loaded_font ? font_stats.glyphs_drawn : strlen(text);
+            }
+            font_stats.glyphs_drawn = 0;
+            add_font_stats(stats, &font_stats);
+
+            free(text);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+// FNV-1a, 64 bits so that a changed item is practically never taken for an unchanged one
+#define ITEM_HASH_INIT 14695981039346656037u
+#define ITEM_HASH_PRIME 1099511628211u
+
+static uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+    return (hash ^ word) * ITEM_HASH_PRIME;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *data, size_t size)
+{
+    // image data is hashed a word at a time
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        uint32_t word;
+        memcpy(&word, data + i, 4);
+        hash = hash_word(hash, word);
+    }
+    for (; i < size; i++) {
+        hash = hash_word(hash, data[i]);
+    }
+    return hash_word(hash, size);
+}
+
+/*
+ * Hash the content of a display list item. Boxed terms other than binaries
+ * are hashed by address, so they are always seen as changed.
+ */
+static uint64_t hash_term(uint64_t hash, term t)
+{
+    if (term_is_tuple(t)) {
+        int arity = term_get_tuple_arity(t);
+        hash = hash_word(hash, arity);
+        for (int i = 0; i < arity; i++) {
+            hash = hash_term(hash, term_get_tuple_element(t, i));
+        }
+        return hash;
+
+    } else if (term_is_nonempty_list(t)) {
+        while (term_is_nonempty_list(t)) {
+            hash = hash_term(hash, term_get_list_head(t));
+            t = term_get_list_tail(t);
+        }
+        return hash_term(hash, t);
+
+    } else if (term_is_binary(t)) {
+        return hash_bytes(hash, (const uint8_t *) term_binary_data(t), term_binary_size(t));
+    }
+
+    return hash_bytes(hash, (const uint8_t *) &t, sizeof(t));
+}
+
+// Clip rect to the screen, returns false when nothing is left
+static bool clip_to_screen(EpdRect *rect)
+{
+    int x1 = rect->x < 0 ? 0 : rect->x;
+    int y1 = rect->y < 0 ? 0 : rect->y;
+    int x2 = rect->x + rect->width > EPD_WIDTH ? EPD_WIDTH : rect->x + rect->width;
+    int y2 = rect->y + rect->height > EPD_HEIGHT ? EPD_HEIGHT : rect->y + rect->height;
+
+    rect->x = x1;
+    rect->y = y1;
+    rect->width = x2 - x1;
+    rect->height = y2 - y1;
+    return rect->width > 0 && rect->height > 0;
+}
+
+static bool rects_intersect(EpdRect a, EpdRect b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width
+        && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+/*
+ * The framebuffer area a display list item draws to, clipped to the screen.
+ * The width is 0 when the item does not draw anything. This is also where
+ * items are validated, once on the port thread when they first appear:
+ * invalid ones are reported and get an empty bbox, so they are never drawn.
+ */
+static EpdRect item_bbox(Context *ctx, term req)
+{
+    struct DisplayData *data = ctx->platform_data;
+    EpdRect bbox = { .x = 0, .y = 0, .width = 0, .height = 0 };
+
+    term cmd = term_get_tuple_element(req, 0);
+
+    switch (display_atom_lookup(data, cmd, FIRST_LIST_COMMAND_ATOM, LAST_LIST_COMMAND_ATOM)) {
+        case ATOM_IMAGE: {
+            term img = term_get_tuple_element(req, 4);
+            term format = term_get_tuple_element(img, 0);
+            int width = term_to_int(term_get_tuple_element(img, 1));
+            int height = term_to_int(term_get_tuple_element(img, 2));
+
+            enum ImageFormat image_format;
+            if (!image_format_from_term(data, format, &image_format)) {
+                fprintf(stderr, "warning: invalid image format: ");
+                term_display(stderr, format, ctx);
+                fprintf(stderr, "\n");
+                return bbox;
+            }
 
-            if (!loaded_font) {
+            size_t data_size;
+            if (!image_data_size(image_format, width, height, &data_size)) {
+                fprintf(stderr, "warning: invalid image size: ");
+                term_display(stderr, img, ctx);
+                fprintf(stderr, "\n");
+                return bbox;
+            }
+            if ((size_t) term_binary_size(term_get_tuple_element(img, 3)) < data_size) {
+                fprintf(stderr, "warning: image data is too short: ");
+                term_display(stderr, img, ctx);
+                fprintf(stderr, "\n");
+                return bbox;
+            }
+
+            bbox.x = term_to_int(term_get_tuple_element(req, 1));
+            bbox.y = term_to_int(term_get_tuple_element(req, 2));
+            bbox.width = width;
+            bbox.height = height;
+            break;
+        }
+
+        case ATOM_RECT:
+        case ATOM_FILL_RECT:
+            bbox.x = term_to_int(term_get_tuple_element(req, 1));
+            bbox.y = term_to_int(term_get_tuple_element(req, 2));
+            bbox.width = term_to_int(term_get_tuple_element(req, 3));
+            bbox.height = term_to_int(term_get_tuple_element(req, 4));
+            break;
+
+        case ATOM_TEXT: {
+            int x = term_to_int(term_get_tuple_element(req, 1));
+            int y = term_to_int(term_get_tuple_element(req, 2));
+            uint32_t fgcolor = term_to_int(term_get_tuple_element(req, 4));
+            int bgcolor = text_bgcolor(term_get_tuple_element(req, 5));
+
+            term font_name = term_get_tuple_element(req, 3);
+            const UFontData *font;
+            if (!find_font(data, font_name, &font)) {
                 fprintf(stderr, "unsupported font: ");
                 term_display(stderr, font_name, ctx);
                 fprintf(stderr, "\n");
-                return;
+                return bbox;
+            }
+
+            int ok;
+            char *text = interop_term_to_string(term_get_tuple_element(req, 6), &ok);
+            data->stats.allocs++;
+            if (!text) {
+                fprintf(stderr, "warning: invalid text: ");
+                term_display(stderr, req, ctx);
+                fprintf(stderr, "\n");
+                return bbox;
+            }
+
+            if (!font) {
+                bbox.x = x;
+                bbox.y = y;
+                bbox.width = strlen(text) * 8;
+                bbox.height = 16;
+            } else {
+                UFontFontProperties props = text_properties(fgcolor, bgcolor);
+                UFontRect rect = ufont_get_draw_rect(font, text, x, y + font->ascender, &props);
+                bbox.x = rect.x;
+                bbox.y = rect.y;
+                bbox.width = rect.width;
+                bbox.height = rect.height;
             }
+
+            free(text);
+            break;
         }
 
-        draw_text(framebuffer, x, y, loaded_font, text, (fgcolor >> 16) & 0xFF, (fgcolor >> 8) & 0xFF,
-            fgcolor & 0xFF, (bgcolor >> 16) & 0xFF, (bgcolor >> 8) & 0xFF, bgcolor & 0xFF);
+        default:
+            fprintf(stderr, "unsupported display list command: ");
+            term_display(stderr, req, ctx);
+            fprintf(stderr, "\n");
+            return bbox;
+    }
 
-        free(text);
+    bbox = raster_rotate_rect(data->rotation, bbox);
+    if (!clip_to_screen(&bbox)) {
+        bbox.width = 0;
+        bbox.height = 0;
+    }
+    return bbox;
+}
 
-    } else {
-        fprintf(stderr, "unsupported display list command: ");
-        term_display(stderr, req, ctx);
-        fprintf(stderr, "\n");
+/*
+ * Slot of hash in the table of diff_display_list: the one whose key, the index
+ * of an old item, has that hash, or else the empty slot where it would go.
+ */
+static int find_item_slot(const int *keys, int mask, const struct DisplayItem *old_items, uint64_t hash)
+{
+    int slot = (int) ((hash ^ (hash >> 32)) & mask);
+    while (keys[slot] >= 0 && old_items[keys[slot]].hash != hash) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+ * Compare the new display list with the last one and add the areas that have
+ * to be drawn again to damage. Items are matched in order by hash: matched
+ * items keep their bbox, the bboxes of the unmatched ones, old and new, are
+ * damaged. Since matched items keep their relative order, everything outside
+ * of the damage is drawn the same way as before.
+ */
+static void diff_display_list(Context *ctx, const term *items, struct DisplayItem *new_items, int len,
+    DamageList *damage)
+{
+    struct DisplayData *data = ctx->platform_data;
+    const struct DisplayItem *old_items = data->items;
+    int old_count = data->items_count;
+
+    /*
+     * Old items by hash, so that a list where everything changed is not
+     * compared item by item: an open addressing table whose slots hold the
+     * first old index with a hash (key) and the next one not matched yet
+     * (head), items with the same hash are chained in order by next_same.
+     */
+    int slots = 1;
+    while (slots < 2 * old_count) {
+        slots <<= 1;
+    }
+    int *keys = malloc(sizeof(int) * (2 * slots + old_count));
+    data->stats.allocs++;
+    if (IS_NULL_PTR(keys)) {
+        fprintf(stderr, "Out of memory.");
+        abort();
+    }
+    int *heads = keys + slots;
+    int *next_same = heads + slots;
+    for (int slot = 0; slot < slots; slot++) {
+        keys[slot] = -1;
+    }
+
+    for (int j = old_count - 1; j >= 0; j--) {
+        int slot = find_item_slot(keys, slots - 1, old_items, old_items[j].hash);
+        next_same[j] = keys[slot];
+        keys[slot] = j;
+        heads[slot] = j;
+    }
+
+    int next_old = 0;
+    for (int i = 0; i < len; i++) {
+        // the first old item with the same hash after the last match
+        int j = -1;
+        int slot = find_item_slot(keys, slots - 1, old_items, new_items[i].hash);
+        if (keys[slot] >= 0) {
+            j = heads[slot];
+            while (j >= 0 && j < next_old) {
+                j = next_same[j];
+            }
+            heads[slot] = j;
+        }
+
+        if (j >= 0) {
+            for (int k = next_old; k < j; k++) {
+                damage_add(damage, old_items[k].bbox);
+            }
+            new_items[i].bbox = old_items[j].bbox;
+            next_old = j + 1;
+        } else {
+            new_items[i].bbox = item_bbox(ctx, items[i]);
+            damage_add(damage, new_items[i].bbox);
+        }
+    }
+
+    for (int k = next_old; k < old_count; k++) {
+        damage_add(damage, old_items[k].bbox);
+    }
+
+    free(keys);
+}
+
+/*
+ * The first band in which bbox is drawn, as damage rect index * RASTER_BANDS
+ * + band, or -1 when it is not drawn. An item is drawn again in every band
+ * it overlaps, but its pixels and glyphs are only counted for this one.
+ */
+static int first_band(const DamageList *damage, EpdRect bbox)
+{
+    for (int r = 0; r < damage->count; r++) {
+        EpdRect rect = damage->rects[r];
+        if (rects_intersect(bbox, rect)) {
+            int y = bbox.y > rect.y ? bbox.y : rect.y;
+            return r * RASTER_BANDS + y / RASTER_BAND_HEIGHT;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Clear and draw the bands of the damaged areas that belong to thread.
+ * Bands do not overlap, so threads never write to the same bytes and the
+ * result is the same as drawing each area at once.
+ */
+static void rasterize_bands(struct DisplayData *data, int thread, struct RenderStats *stats)
+{
+    const struct RasterJob *job = &data->raster_job;
+
+    for (int r = 0; r < job->damage->count; r++) {
+        EpdRect rect = job->damage->rects[r];
+        int end_y = rect.y + rect.height;
+
+        for (int band = rect.y / RASTER_BAND_HEIGHT; band * RASTER_BAND_HEIGHT < end_y; band++) {
+            if (band % RASTER_THREADS != thread) {
+                continue;
+            }
+
+            RasterTarget target;
+            raster_target_init(&target, data->draw_fb);
+            target.clip.x = rect.x;
+            target.clip.width = rect.width;
+            target.clip.y = band * RASTER_BAND_HEIGHT > rect.y ? band * RASTER_BAND_HEIGHT : rect.y;
+            target.clip.height = ((band + 1) * RASTER_BAND_HEIGHT < end_y ? (band + 1) * RASTER_BAND_HEIGHT : end_y)
+                - target.clip.y;
+
+            // the clip is in framebuffer coordinates, so the band is cleared before the rotation is set
+            raster_fill_rect(&target, target.clip.x, target.clip.y, target.clip.width, target.clip.height, 0xF);
+            target.rotation = data->rotation;
+            for (int i = 0; i < job->len; i++) {
+                if (rects_intersect(job->display_items[i].bbox, target.clip)) {
+                    bool counted = job->display_items[i].first_band == r * RASTER_BANDS + band;
+                    execute_command(job->ctx, job->items[i], &target, counted, stats);
+                }
+            }
+        }
+    }
+}
+
+static void raster_task(void *arg)
+{
+    struct RasterWorker *worker = arg;
+
+    for (;;) {
+        xSemaphoreTake(worker->start, portMAX_DELAY);
+        memset(&worker->stats, 0, sizeof(struct RenderStats));
+        rasterize_bands(worker->data, worker->thread, &worker->stats);
+        xSemaphoreGive(worker->done);
     }
 }
 
+static bool start_raster_workers(struct DisplayData *data)
+{
+    for (int t = 1; t < RASTER_THREADS; t++) {
+        struct RasterWorker *worker = &data->raster_workers[t];
+        worker->data = data;
+        worker->thread = t;
+        worker->start = xSemaphoreCreateBinary();
+        worker->done = xSemaphoreCreateBinary();
+        if (worker->start == NULL || worker->done == NULL) {
+            fprintf(stderr, "failed to create raster semaphores.\n");
+            return false;
+        }
+
+        // one worker per core, the port runs on core 0
+        if (xTaskCreatePinnedToCore(raster_task, "epd_raster", RASTER_TASK_STACK_SIZE, worker,
+                RASTER_TASK_PRIORITY, NULL, t) != pdPASS) {
+            fprintf(stderr, "failed to create raster task.\n");
+            return false;
+        }
+    }
+    return true;
+}
+
 static void do_update(Context *ctx, term display_list)
 {
+    struct DisplayData *data = ctx->platform_data;
+    struct RenderStats *stats = &data->stats;
+
+    int64_t start = esp_timer_get_time();
+    ufont_reset_stats();
+
     int proper;
     int len = term_list_length(display_list, &proper);
 
     term *items = malloc(sizeof(term) * len);
+    struct DisplayItem *new_items = malloc(sizeof(struct DisplayItem) * len);
+    stats->allocs += 2;
+    if (len > 0 && (IS_NULL_PTR(items) || IS_NULL_PTR(new_items))) {
+        fprintf(stderr, "Out of memory.");
+        abort();
+    }
 
     term t = display_list;
     for (int i = len - 1; i >= 0; i--) {
         items[i] = term_get_list_head(t);
+        new_items[i].hash = hash_term(ITEM_HASH_INIT, items[i]);
         t = term_get_list_tail(t);
     }
 
+    DamageList damage;
+    damage_init(&damage);
+    if (data->items_valid) {
+        diff_display_list(ctx, items, new_items, len, &damage);
+    } else {
+        for (int i = 0; i < len; i++) {
+            new_items[i].bbox = item_bbox(ctx, items[i]);
+        }
+        damage_add(&damage, epd_full_screen());
+    }
+
     for (int i = 0; i < len; i++) {
-        execute_command(ctx, items[i]);
+        new_items[i].first_band = first_band(&damage, new_items[i].bbox);
+        if (new_items[i].first_band >= 0) {
+            stats->commands++;
+        }
+    }
+
+    // only the damaged areas are cleared and drawn again, by the items that overlap them
+    struct RasterJob *job = &data->raster_job;
+    job->ctx = ctx;
+    job->items = items;
+    job->display_items = new_items;
+    job->len = len;
+    job->damage = &damage;
+
+    for (int t = 1; t < RASTER_THREADS; t++) {
+        xSemaphoreGive(data->raster_workers[t].start);
+    }
+    rasterize_bands(data, 0, stats);
+    for (int t = 1; t < RASTER_THREADS; t++) {
+        struct RasterWorker *worker = &data->raster_workers[t];
+        xSemaphoreTake(worker->done, portMAX_DELAY);
+        stats->pixels += worker->stats.pixels;
+        stats->glyphs += worker->stats.glyphs;
+        stats->allocs += worker->stats.allocs;
+        stats->glyph_cache_hits += worker->stats.glyph_cache_hits;
+        stats->glyph_cache_misses += worker->stats.glyph_cache_misses;
+        stats->layout_cache_hits += worker->stats.layout_cache_hits;
+        stats->layout_cache_misses += worker->stats.layout_cache_misses;
     }
 
+    // drawing an area again does not always change it, e.g. a new color can map to the same gray level
+    stats->dirty_tiles = damage_scan_tiles(&data->frame_damage, &data->tiles, data->draw_fb, &damage);
+
     free(items);
+    free(data->items);
+    data->items = new_items;
+    data->items_count = len;
+    data->items_valid = true;
+
+    // the layouts looked up by item_bbox
+    UFontStats font_stats;
+    ufont_get_stats(&font_stats);
+    add_font_stats(stats, &font_stats);
+    stats->raster_us = esp_timer_get_time() - start;
+}
+
+static term make_stats_term(Context *ctx, const struct DisplayData *data)
+{
+    const struct RenderStats *stats = &data->stats;
+    uint32_t values[RENDER_STATS_ITEMS] = {
+        stats->updates,
+        stats->commands,
+        stats->pixels,
+        stats->dirty_tiles,
+        stats->glyphs,
+        stats->allocs,
+        stats->glyph_cache_hits,
+        stats->glyph_cache_misses,
+        stats->layout_cache_hits,
+        stats->layout_cache_misses,
+        stats->raster_us,
+        stats->refresh_us,
+        stats->refresh_areas,
+        stats->refresh_clean,
+        stats->power_ons,
+        stats->powered_ms
+    };
+
+    term result = term_nil();
+    for (int i = RENDER_STATS_ITEMS - 1; i >= 0; i--) {
+        term item = term_alloc_tuple(2, ctx);
+        term_put_tuple_element(item, 0, data->atoms[ATOM_UPDATES + i]);
+        // running totals such as powered_ms stop at the largest small integer instead of wrapping
+        uint32_t value = values[i] < MAX_NOT_BOXED_INT ? values[i] : MAX_NOT_BOXED_INT;
+        term_put_tuple_element(item, 1, term_from_int32(value));
+        result = term_list_prepend(item, result, ctx);
+    }
+
+    return result;
+}
+
+static void send_reply(Context *ctx, Context *target, term from, term reply)
+{
+    struct DisplayData *data = ctx->platform_data;
+
+    term return_tuple = term_alloc_tuple(3, ctx);
+    term_put_tuple_element(return_tuple, 0, data->atoms[ATOM_REPLY]);
+    term_put_tuple_element(return_tuple, 1, from);
+    term_put_tuple_element(return_tuple, 2, reply);
+
+    mailbox_send(target, return_tuple);
+}
+
+static EpdRect rect_union(EpdRect a, EpdRect b)
+{
+    int x1 = a.x < b.x ? a.x : b.x;
+    int y1 = a.y < b.y ? a.y : b.y;
+    int x2 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y2 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+
+    EpdRect u = {
+        .x = x1,
+        .y = y1,
+        .width = x2 - x1,
+        .height = y2 - y1
+    };
+    return u;
+}
+
+static EpdRect rect_intersection(EpdRect a, EpdRect b)
+{
+    int x1 = a.x > b.x ? a.x : b.x;
+    int y1 = a.y > b.y ? a.y : b.y;
+    int x2 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y2 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+
+    EpdRect i = {
+        .x = x1,
+        .y = y1,
+        .width = x2 > x1 ? x2 - x1 : 0,
+        .height = y2 > y1 ? y2 - y1 : 0
+    };
+    return i;
+}
+
+static void start_refresh(struct DisplayData *data)
+{
+    // outside of frame_damage, draw_fb and front_fb are the same, so only the
+    // damaged parts of the flushed area have to be copied and refreshed
+    DamageList *damage = &data->frame_damage;
+    DamageList areas;
+    damage_init(&areas);
+    bool flushed_all = true;
+    for (int i = 0; i < damage->count; i++) {
+        EpdRect rect = rect_intersection(damage->rects[i], data->flush_area);
+        if (rect.width != damage->rects[i].width || rect.height != damage->rects[i].height) {
+            flushed_all = false;
+        }
+
+        int first_byte = rect.x / 2;
+        int end_byte = (rect.x + rect.width + 1) / 2;
+        for (int y = rect.y; y < rect.y + rect.height; y++) {
+            int offset = y * (EPD_WIDTH / 2) + first_byte;
+            memcpy(data->hl.front_fb + offset, data->draw_fb + offset, end_byte - first_byte);
+        }
+        damage_add(&areas, rect);
+    }
+    // a partly flushed area stays damaged, copying it again later is harmless
+    if (flushed_all) {
+        damage_init(damage);
+    }
+    data->flush_pending = false;
+
+    // the callers waiting for this frame are now waiting for this refresh
+    if (!list_is_empty(&data->pending_replies)) {
+        struct ListHead *first = data->pending_replies.next;
+        struct ListHead *last = data->pending_replies.prev;
+        struct ListHead *running = &data->running_replies;
+        first->prev = running->prev;
+        running->prev->next = first;
+        last->next = running;
+        running->prev = last;
+        list_init(&data->pending_replies);
+    }
+
+    data->refresh_running = true;
+    refresh_worker_submit(&data->refresh, data->flush_mode, &areas);
+}
+
+/*
+ * Refresh area of the panel with what has been drawn so far, pending is
+ * answered once it is done. Flushes requested while a refresh is running
+ * are merged into the next one.
+ */
+static void request_flush(struct DisplayData *data, EpdRect area, enum RefreshMode mode,
+    struct PendingReply *pending)
+{
+    data->flush_area = data->flush_pending ? rect_union(data->flush_area, area) : area;
+    data->flush_mode = mode;
+    data->flush_pending = true;
+    list_append(&data->pending_replies, &pending->head);
+
+    if (!data->refresh_running) {
+        start_refresh(data);
+    }
+}
+
+// Called from the scheduler once the refresh worker has posted its completion to event_queue
+static void refresh_done(EventListener *listener)
+{
+    Context *ctx = listener->data;
+    struct DisplayData *data = ctx->platform_data;
+
+    data->refresh_running = false;
+    data->stats.refresh_us = data->refresh.refresh_us;
+    data->stats.refresh_areas = data->refresh.areas;
+    data->stats.refresh_clean = data->refresh.clean;
+    data->stats.power_ons = data->refresh.power_ons;
+    data->stats.powered_ms = data->refresh.powered_ms;
+
+    struct ListHead *item;
+    struct ListHead *tmp;
+    MUTABLE_LIST_FOR_EACH (item, tmp, &data->running_replies) {
+        struct PendingReply *pending = GET_LIST_ENTRY(item, struct PendingReply, head);
+
+        Context *target = globalcontext_get_process(ctx->global, pending->local_process_id);
+        if (target) {
+            if (UNLIKELY(memory_ensure_free(ctx, TUPLE_SIZE(3) + TUPLE_SIZE(2) + REF_SIZE) != MEMORY_GC_OK)) {
+                abort();
+            }
+            term from = term_alloc_tuple(2, ctx);
+            term_put_tuple_element(from, 0, term_from_local_process_id(pending->local_process_id));
+            term_put_tuple_element(from, 1, term_from_ref_ticks(pending->ref_ticks, ctx));
+            send_reply(ctx, target, from, OK_ATOM);
+        }
+
+        list_remove(item);
+        free(pending);
+    }
+
+    if (data->flush_pending) {
+        start_refresh(data);
+    }
+}
+
+static struct PendingReply *new_pending_reply(int local_process_id, term ref)
+{
+    struct PendingReply *pending = malloc(sizeof(struct PendingReply));
+    if (IS_NULL_PTR(pending)) {
+        fprintf(stderr, "Out of memory.");
+        abort();
+    }
+    pending->local_process_id = local_process_id;
+    pending->ref_ticks = term_to_ref_ticks(ref);
+    return pending;
+}
+
+// auto, du, gl16 or gc16, anything else is the default mode
+static enum RefreshMode parse_refresh_mode(Context *ctx, term mode)
+{
+    struct DisplayData *data = ctx->platform_data;
+
+    switch (display_atom_lookup(data, mode, FIRST_REFRESH_MODE_ATOM, LAST_REFRESH_MODE_ATOM)) {
+        case ATOM_DU:
+            return REFRESH_MODE_DU;
+        case ATOM_GL16:
+            return REFRESH_MODE_GL16;
+        case ATOM_GC16:
+            return REFRESH_MODE_GC16;
+        case ATOM_AUTO:
+            return REFRESH_MODE_AUTO;
+        default:
+            fprintf(stderr, "warning: invalid refresh mode: ");
+            term_display(stderr, mode, ctx);
+            fprintf(stderr, "\n");
+            return data->default_mode;
+    }
+}
+
+// all or {X, Y, Width, Height}
+static bool parse_area(const struct DisplayData *data, term t, EpdRect *area)
+{
+    if (t == data->atoms[ATOM_ALL]) {
+        *area = epd_full_screen();
+        return true;
+    }
+
+    if (!term_is_tuple(t) || term_get_tuple_arity(t) != 4) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!term_is_integer(term_get_tuple_element(t, i))) {
+            return false;
+        }
+    }
+
+    area->x = term_to_int(term_get_tuple_element(t, 0));
+    area->y = term_to_int(term_get_tuple_element(t, 1));
+    area->width = term_to_int(term_get_tuple_element(t, 2));
+    area->height = term_to_int(term_get_tuple_element(t, 3));
+    *area = raster_rotate_rect(data->rotation, *area);
+    clip_to_screen(area);
+    return true;
+}
+
+// Draw a display list into draw_fb, it is shown on the panel by the next flush
+static void draw_display_list(Context *ctx, term display_list)
+{
+    struct DisplayData *data = ctx->platform_data;
+
+    struct RenderStats last = data->stats;
+    memset(&data->stats, 0, sizeof(struct RenderStats));
+    data->stats.updates = last.updates + 1;
+    data->stats.refresh_us = last.refresh_us;
+    data->stats.refresh_areas = last.refresh_areas;
+    data->stats.refresh_clean = last.refresh_clean;
+    data->stats.power_ons = last.power_ons;
+    data->stats.powered_ms = last.powered_ms;
+
+    do_update(ctx, display_list);
+}
+
+/*
+ * Whether msg is a well formed {'$call', {Pid, Ref}, {update, ...}} message.
+ */
+static bool is_update_call(const struct DisplayData *data, term msg)
+{
+    if (!term_is_tuple(msg) || term_get_tuple_arity(msg) != 3
+        || term_get_tuple_element(msg, 0) != data->atoms[ATOM_CALL]) {
+        return false;
+    }
+
+    term from = term_get_tuple_element(msg, 1);
+    if (!term_is_tuple(from) || term_get_tuple_arity(from) != 2
+        || !term_is_pid(term_get_tuple_element(from, 0))
+        || !term_is_reference(term_get_tuple_element(from, 1))) {
+        return false;
+    }
+
+    term req = term_get_tuple_element(msg, 2);
+    return term_is_tuple(req) && term_get_tuple_arity(req) >= 2
+        && term_get_tuple_element(req, 0) == data->atoms[ATOM_UPDATE];
 }
 
-static void process_message(Context *ctx)
+/*
+ * Handle the first message in the mailbox. queued_updates is the number of
+ * update calls still in the mailbox: all but the last one are superseded and
+ * are not drawn, their callers are answered along with the last one.
+ */
+static void process_message(Context *ctx, int *queued_updates)
 {
+    struct DisplayData *data = ctx->platform_data;
+
     Message *message = mailbox_dequeue(ctx);
     term msg = message->message;
 
     if (!term_is_tuple(msg) ||
             term_get_tuple_arity(msg) != 3 ||
-            term_get_tuple_element(msg, 0) != context_make_atom(ctx, "\x5" "$call")) {
+            term_get_tuple_element(msg, 0) != data->atoms[ATOM_CALL]) {
         goto invalid_message;
     }
 
@@ -219,46 +1310,96 @@ static void process_message(Context *ctx)
     int local_process_id = term_to_local_process_id(pid);
     Context *target = globalcontext_get_process(ctx->global, local_process_id);
 
-    if (cmd == context_make_atom(ctx, "\x6"
-                                      "update")) {
-        // let's do a full clear to avoid ghost effect
-        // TODO: let's find a better approach that doesn't require any full clear
-        int temperature = epd_ambient_temperature();
-        epd_fullclear((EpdiyHighlevelState *) ctx->platform_data, temperature);
+    int reply_size = 0;
+    bool reply_stats = false;
 
-        term display_list = term_get_tuple_element(req, 1);
-        do_update(ctx, display_list);
+    switch (display_atom_lookup(data, cmd, FIRST_CALL_ATOM, LAST_CALL_ATOM)) {
+        case ATOM_UPDATE: {
+            if (!is_update_call(data, msg)) {
+                goto invalid_message;
+            }
+            struct PendingReply *pending = new_pending_reply(local_process_id, term_get_tuple_element(from, 1));
 
-    } else if (cmd == context_make_atom(ctx, "\xD" "register_font")) {
-        term font_bin = term_get_tuple_element(req, 2);
-        UFontData *loaded_font = ufont_parse(term_binary_data(font_bin), term_binary_size(font_bin));
+            (*queued_updates)--;
+            if (*queued_updates > 0) {
+                list_append(&data->pending_replies, &pending->head);
+                free(message);
+                return;
+            }
 
-        AtomString handle_atom = globalcontext_atomstring_from_term(ctx->global, term_get_tuple_element(req, 1));
-        char handle[255];
-        atom_string_to_c(handle_atom, handle, sizeof(handle));
-        ufont_manager_register(ufont_manager, handle, loaded_font);
+            enum RefreshMode mode = data->default_mode;
+            if (term_get_tuple_arity(req) > 2) {
+                mode = parse_refresh_mode(ctx, term_get_tuple_element(req, 2));
+            }
 
-    } else {
-        fprintf(stderr, "unsupported command: ");
-        term_display(stderr, req, ctx);
-        fprintf(stderr, "\n");
+            draw_display_list(ctx, term_get_tuple_element(req, 1));
+
+            // the reply is sent by refresh_done once this frame is on the panel
+            request_flush(data, epd_full_screen(), mode, pending);
+
+            free(message);
+            return;
+        }
+
+        case ATOM_DRAW:
+            if (term_get_tuple_arity(req) < 2) {
+                goto invalid_message;
+            }
+            draw_display_list(ctx, term_get_tuple_element(req, 1));
+            break;
+
+        case ATOM_FLUSH: {
+            term ref = term_get_tuple_element(from, 1);
+            if (!term_is_reference(ref)) {
+                goto invalid_message;
+            }
+
+            EpdRect area = epd_full_screen();
+            if (term_get_tuple_arity(req) > 1 && !parse_area(data, term_get_tuple_element(req, 1), &area)) {
+                goto invalid_message;
+            }
+            enum RefreshMode mode = data->default_mode;
+            if (term_get_tuple_arity(req) > 2) {
+                mode = parse_refresh_mode(ctx, term_get_tuple_element(req, 2));
+            }
+
+            request_flush(data, area, mode, new_pending_reply(local_process_id, ref));
+
+            free(message);
+            return;
+        }
+
+        case ATOM_REGISTER_FONT: {
+            term font_bin = term_get_tuple_element(req, 2);
+            UFontData *loaded_font = ufont_parse(term_binary_data(font_bin), term_binary_size(font_bin));
+
+            term handle_term = term_get_tuple_element(req, 1);
+            AtomString handle_atom = globalcontext_atomstring_from_term(ctx->global, handle_term);
+            char handle[255];
+            atom_string_to_c(handle_atom, handle, sizeof(handle));
+            ufont_manager_register_with_id(ufont_manager, handle, term_to_atom_index(handle_term), loaded_font);
+            // text already drawn with this name might look different now
+            data->items_valid = false;
+            break;
+        }
+
+        case ATOM_STATS:
+            reply_stats = true;
+            reply_size = RENDER_STATS_TERM_SIZE;
+            break;
+
+        default:
+            fprintf(stderr, "unsupported command: ");
+            term_display(stderr, req, ctx);
+            fprintf(stderr, "\n");
     }
 
-    if (UNLIKELY(memory_ensure_free(ctx, TUPLE_SIZE(3)) != MEMORY_GC_OK)) {
+    if (UNLIKELY(memory_ensure_free(ctx, TUPLE_SIZE(3) + reply_size) != MEMORY_GC_OK)) {
         abort();
     }
 
-    epd_poweron();
-    int temperature = epd_ambient_temperature();
-    epd_hl_update_screen((EpdiyHighlevelState *) ctx->platform_data, MODE_GC16, temperature);
-    epd_poweroff();
-
-    term return_tuple = term_alloc_tuple(3, ctx);
-    term_put_tuple_element(return_tuple, 0, context_make_atom(ctx, "\x6" "$reply"));
-    term_put_tuple_element(return_tuple, 1, from);
-    term_put_tuple_element(return_tuple, 2, OK_ATOM);
-
-    mailbox_send(target, return_tuple);
+    term reply = reply_stats ? make_stats_term(ctx, data) : OK_ATOM;
+    send_reply(ctx, target, from, reply);
 
     free(message);
 
@@ -275,15 +1416,56 @@ invalid_message:
 
 static void consume_display_mailbox(Context *ctx)
 {
+    struct DisplayData *data = ctx->platform_data;
+
+    // when updates come in bursts only the latest display list is drawn and refreshed
+    int queued_updates = 0;
+    struct ListHead *item;
+    LIST_FOR_EACH (item, &ctx->mailbox) {
+        Message *message = GET_LIST_ENTRY(item, Message, mailbox_list_head);
+        if (is_update_call(data, message->message)) {
+            queued_updates++;
+        }
+    }
+
     while (!list_is_empty(&ctx->mailbox)) {
-        process_message(ctx);
+        process_message(ctx, &queued_updates);
     }
 }
 
-Context *display_create_port(GlobalContext *global, term opts)
+// Value of key in the opts proplist, default_value if it is missing or not a non negative integer
+static int int_option(Context *ctx, term opts, enum DisplayAtom key, int default_value)
+{
+    struct DisplayData *data = ctx->platform_data;
+
+    term value = interop_proplist_get_value_default(opts, data->atoms[key], term_from_int(default_value));
+    if (!term_is_integer(value) || term_to_int(value) < 0) {
+        fprintf(stderr, "warning: invalid display option: ");
+        term_display(stderr, value, ctx);
+        fprintf(stderr, "\n");
+        return default_value;
+    }
+
+    return term_to_int(value);
+}
+
+static bool bool_option(Context *ctx, term opts, enum DisplayAtom key, bool default_value)
 {
-    UNUSED(opts);
+    struct DisplayData *data = ctx->platform_data;
 
+    term value = interop_proplist_get_value_default(opts, data->atoms[key], default_value ? TRUE_ATOM : FALSE_ATOM);
+    if (value != TRUE_ATOM && value != FALSE_ATOM) {
+        fprintf(stderr, "warning: invalid display option: ");
+        term_display(stderr, value, ctx);
+        fprintf(stderr, "\n");
+        return default_value;
+    }
+
+    return value == TRUE_ATOM;
+}
+
+Context *display_create_port(GlobalContext *global, term opts)
+{
     Context *ctx = context_new(global);
     if (IS_NULL_PTR(ctx)) {
         fprintf(stderr, "Out of memory.");
@@ -292,23 +1474,88 @@ Context *display_create_port(GlobalContext *global, term opts)
     ctx->native_handler = consume_display_mailbox;
 
     ufont_manager = ufont_manager_new();
+    raster_init(1.0f);
 
-    EpdiyHighlevelState *hl = calloc(sizeof(EpdiyHighlevelState), 1);
+    struct DisplayData *data = calloc(sizeof(struct DisplayData), 1);
+    EpdiyHighlevelState *hl = &data->hl;
     epd_init(EPD_OPTIONS_DEFAULT);
     *hl = epd_hl_init(EPD_BUILTIN_WAVEFORM);
-    ctx->platform_data = hl;
+    ctx->platform_data = data;
+
+    for (int i = 0; i < DISPLAY_ATOMS_COUNT; i++) {
+        data->atoms[i] = context_make_atom(ctx, display_atom_names[i]);
+    }
+
+    data->rotation = int_option(ctx, opts, ATOM_ROTATION, 0);
+    if (data->rotation != 0 && data->rotation != 90 && data->rotation != 180 && data->rotation != 270) {
+        fprintf(stderr, "warning: rotation must be 0, 90, 180 or 270.\n");
+        data->rotation = 0;
+    }
+
+    data->default_mode = REFRESH_MODE_AUTO;
+    data->default_mode = parse_refresh_mode(ctx,
+        interop_proplist_get_value_default(opts, data->atoms[ATOM_REFRESH_MODE], data->atoms[ATOM_AUTO]));
+
+    ufont_glyph_cache_set_size(int_option(ctx, opts, ATOM_GLYPH_CACHE_SIZE, UFONT_GLYPH_CACHE_DEFAULT_SIZE));
+    ufont_layout_cache_set_size(int_option(ctx, opts, ATOM_LAYOUT_CACHE_SIZE, UFONT_LAYOUT_CACHE_DEFAULT_SIZE));
+
+    // the highlevel framebuffers are always allocated by epdiy, in PSRAM
+    term placement = interop_proplist_get_value_default(opts, data->atoms[ATOM_FRAMEBUFFER], data->atoms[ATOM_PSRAM]);
+    if (placement == data->atoms[ATOM_INTERNAL]) {
+        data->draw_fb = heap_caps_malloc(EPD_WIDTH / 2 * EPD_HEIGHT, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (IS_NULL_PTR(data->draw_fb)) {
+            fprintf(stderr, "warning: not enough internal RAM for the framebuffer, using PSRAM.\n");
+        }
+    } else if (placement != data->atoms[ATOM_PSRAM]) {
+        fprintf(stderr, "warning: framebuffer must be psram or internal.\n");
+    }
+    if (data->draw_fb == NULL) {
+        data->draw_fb = heap_caps_malloc(EPD_WIDTH / 2 * EPD_HEIGHT, MALLOC_CAP_SPIRAM);
+    }
+    if (IS_NULL_PTR(data->draw_fb)) {
+        fprintf(stderr, "Out of memory.");
+        return NULL;
+    }
+    memset(data->draw_fb, 0xFF, EPD_WIDTH / 2 * EPD_HEIGHT);
+    damage_tiles_init(&data->tiles, data->draw_fb);
+    list_init(&data->pending_replies);
+    list_init(&data->running_replies);
 
     uint8_t *framebuffer = epd_hl_get_framebuffer(hl);
 
-    epd_poweron();
+    PanelPower *power = &data->refresh.power;
+    panel_power_init(power);
+    power->idle_timeout_ms = int_option(ctx, opts, ATOM_IDLE_TIMEOUT_MS, POWER_DEFAULT_IDLE_TIMEOUT_MS);
 
-    epd_fill_rect(epd_full_screen(), 255, framebuffer);
+    // without the clear, whatever was on the panel stays there until it is drawn over
+    if (bool_option(ctx, opts, ATOM_CLEAR_ON_START, true)) {
+        // the panel is left on, the refresh worker turns it off once idle
+        panel_power_on(power);
 
-    epd_clear();
-    int temperature = epd_ambient_temperature();
-    epd_hl_update_screen((EpdiyHighlevelState *) ctx->platform_data, MODE_GC16, temperature);
+        epd_fill_rect(epd_full_screen(), 255, framebuffer);
 
-    epd_poweroff();
+        epd_clear();
+        epd_hl_update_screen(hl, MODE_GC16, panel_power_temperature(power));
+    }
+
+    if (!start_raster_workers(data)) {
+        return NULL;
+    }
+
+    struct ESP32PlatformData *platform = global->platform_data;
+    EventListener *listener = &data->refresh_listener;
+    listener->handler = refresh_done;
+    listener->data = ctx;
+    listener->sender = &data->refresh;
+    list_append(&platform->listeners, &listener->listeners_list_head);
+
+    if (!refresh_worker_start(&data->refresh, hl, event_queue, &data->refresh)) {
+        return NULL;
+    }
+    data->stats.power_ons = data->refresh.power_ons;
+    data->stats.powered_ms = data->refresh.powered_ms;
+    // only read by the worker once something is submitted
+    data->refresh.ghosting_budget = int_option(ctx, opts, ATOM_GHOSTING_BUDGET, REFRESH_DEFAULT_GHOSTING_BUDGET);
 
     return ctx;
 }
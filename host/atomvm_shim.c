@@ -0,0 +1,369 @@
+/*
+ * Host build: terms, processes, mailboxes and events of the AtomVM subset in
+ * include/. Everything runs on the thread that calls the native handlers,
+ * except sys_consume_pending_events which is fed by the FreeRTOS queue.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "context.h"
+#include "defaultatoms.h"
+#include "esp32_sys.h"
+#include "globalcontext.h"
+#include "interop.h"
+#include "mailbox.h"
+#include "sys.h"
+#include "term.h"
+
+QueueHandle_t event_queue;
+
+// term memory is only released at exit
+struct Allocation
+{
+    struct Allocation *next;
+    max_align_t data[];
+};
+
+static struct Allocation *allocations;
+static pthread_mutex_t allocations_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_allocations()
+{
+    while (allocations) {
+        struct Allocation *next = allocations->next;
+        free(allocations);
+        allocations = next;
+    }
+}
+
+static void *term_memory(size_t size)
+{
+    struct Allocation *allocation = malloc(sizeof(struct Allocation) + size);
+    if (IS_NULL_PTR(allocation)) {
+        fprintf(stderr, "Out of memory.\n");
+        abort();
+    }
+
+    pthread_mutex_lock(&allocations_mutex);
+    if (!allocations) {
+        atexit(free_allocations);
+    }
+    allocation->next = allocations;
+    allocations = allocation;
+    pthread_mutex_unlock(&allocations_mutex);
+
+    return allocation->data;
+}
+
+static struct TermBoxed *alloc_boxed(enum TermBoxedKind kind, int size, size_t payload)
+{
+    struct TermBoxed *boxed = term_memory(offsetof(struct TermBoxed, data) + (payload ? payload : 1));
+    boxed->kind = kind;
+    boxed->size = size;
+    return boxed;
+}
+
+term term_alloc_tuple(int arity, Context *ctx)
+{
+    UNUSED(ctx);
+
+    struct TermBoxed *boxed = alloc_boxed(TERM_BOXED_TUPLE, arity, sizeof(term) * arity);
+    for (int i = 0; i < arity; i++) {
+        boxed->elements[i] = term_nil();
+    }
+    return (term) boxed | TERM_BOXED_TAG;
+}
+
+term term_list_prepend(term head, term tail, Context *ctx)
+{
+    UNUSED(ctx);
+
+    struct TermCons *cons = term_memory(sizeof(struct TermCons));
+    cons->head = head;
+    cons->tail = tail;
+    return (term) cons | TERM_LIST_TAG;
+}
+
+term term_from_literal_binary(const void *data, uint32_t size, Context *ctx)
+{
+    UNUSED(ctx);
+
+    struct TermBoxed *boxed = alloc_boxed(TERM_BOXED_BINARY, size, size);
+    memcpy(boxed->data, data, size);
+    return (term) boxed | TERM_BOXED_TAG;
+}
+
+term term_from_ref_ticks(uint64_t ref_ticks, Context *ctx)
+{
+    UNUSED(ctx);
+
+    struct TermBoxed *boxed = alloc_boxed(TERM_BOXED_REF, 0, sizeof(uint64_t));
+    boxed->ref_ticks = ref_ticks;
+    return (term) boxed | TERM_BOXED_TAG;
+}
+
+int term_list_length(term t, int *proper)
+{
+    int len = 0;
+    while (term_is_nonempty_list(t)) {
+        len++;
+        t = term_get_list_tail(t);
+    }
+    *proper = term_is_nil(t);
+    return len;
+}
+
+// Interned atoms, as length prefixed strings
+#define MAX_ATOMS 1024
+
+static AtomString atoms[MAX_ATOMS] = {
+    [FALSE_ATOM_INDEX] = "\x5" "false",
+    [TRUE_ATOM_INDEX] = "\x4" "true",
+    [OK_ATOM_INDEX] = "\x2" "ok",
+    [ERROR_ATOM_INDEX] = "\x5" "error",
+    [UNDEFINED_ATOM_INDEX] = "\x9" "undefined"
+};
+static int atoms_count = UNDEFINED_ATOM_INDEX + 1;
+
+term context_make_atom(Context *ctx, AtomString string)
+{
+    UNUSED(ctx);
+
+    const char *s = string;
+    for (int i = 0; i < atoms_count; i++) {
+        const char *atom = atoms[i];
+        if (atom[0] == s[0] && !memcmp(atom + 1, s + 1, s[0])) {
+            return term_from_atom_index(i);
+        }
+    }
+
+    if (atoms_count == MAX_ATOMS) {
+        fprintf(stderr, "Too many atoms.\n");
+        abort();
+    }
+    char *copy = term_memory(s[0] + 1);
+    memcpy(copy, s, s[0] + 1);
+    atoms[atoms_count] = copy;
+    return term_from_atom_index(atoms_count++);
+}
+
+AtomString globalcontext_atomstring_from_term(GlobalContext *glb, term t)
+{
+    UNUSED(glb);
+
+    return atoms[term_to_atom_index(t)];
+}
+
+void atom_string_to_c(AtomString atom_string, char *buf, size_t bufsize)
+{
+    const char *s = atom_string;
+    size_t len = (uint8_t) s[0];
+    if (len >= bufsize) {
+        len = bufsize - 1;
+    }
+    memcpy(buf, s + 1, len);
+    buf[len] = '\0';
+}
+
+void term_display(FILE *fd, term t, const Context *ctx)
+{
+    if (term_is_integer(t)) {
+        fprintf(fd, "%ld", (long) term_to_int(t));
+
+    } else if (term_is_atom(t)) {
+        const char *s = atoms[term_to_atom_index(t)];
+        fprintf(fd, "%.*s", (int) (uint8_t) s[0], s + 1);
+
+    } else if (term_is_pid(t)) {
+        fprintf(fd, "<0.%i.0>", term_to_local_process_id(t));
+
+    } else if (term_is_nil(t)) {
+        fprintf(fd, "[]");
+
+    } else if (term_is_nonempty_list(t)) {
+        fprintf(fd, "[");
+        while (term_is_nonempty_list(t)) {
+            term_display(fd, term_get_list_head(t), ctx);
+            t = term_get_list_tail(t);
+            if (term_is_nonempty_list(t)) {
+                fprintf(fd, ",");
+            }
+        }
+        if (!term_is_nil(t)) {
+            fprintf(fd, "|");
+            term_display(fd, t, ctx);
+        }
+        fprintf(fd, "]");
+
+    } else if (term_is_tuple(t)) {
+        fprintf(fd, "{");
+        for (int i = 0; i < term_get_tuple_arity(t); i++) {
+            if (i) {
+                fprintf(fd, ",");
+            }
+            term_display(fd, term_get_tuple_element(t, i), ctx);
+        }
+        fprintf(fd, "}");
+
+    } else if (term_is_binary(t)) {
+        fprintf(fd, "<<%i bytes>>", term_binary_size(t));
+
+    } else if (term_is_reference(t)) {
+        fprintf(fd, "#Ref<0.0.0.%llu>", (unsigned long long) term_to_ref_ticks(t));
+
+    } else {
+        fprintf(fd, "Unknown term: %lx", (unsigned long) t);
+    }
+}
+
+char *interop_term_to_string(term t, int *ok)
+{
+    if (term_is_binary(t)) {
+        int len = term_binary_size(t);
+        char *str = malloc(len + 1);
+        if (IS_NULL_PTR(str)) {
+            *ok = 0;
+            return NULL;
+        }
+        memcpy(str, term_binary_data(t), len);
+        str[len] = '\0';
+        *ok = 1;
+        return str;
+    }
+
+    int proper;
+    int len = term_list_length(t, &proper);
+    char *str = proper ? malloc(len + 1) : NULL;
+    if (IS_NULL_PTR(str)) {
+        *ok = 0;
+        return NULL;
+    }
+    for (int i = 0; i < len; i++) {
+        term c = term_get_list_head(t);
+        if (!term_is_integer(c)) {
+            free(str);
+            *ok = 0;
+            return NULL;
+        }
+        str[i] = term_to_int(c);
+        t = term_get_list_tail(t);
+    }
+    str[len] = '\0';
+    *ok = 1;
+    return str;
+}
+
+term interop_proplist_get_value_default(term list, term key, term default_value)
+{
+    while (term_is_nonempty_list(list)) {
+        term item = term_get_list_head(list);
+        if (term_is_tuple(item) && term_get_tuple_arity(item) == 2 && term_get_tuple_element(item, 0) == key) {
+            return term_get_tuple_element(item, 1);
+        }
+        if (item == key) {
+            return TRUE_ATOM;
+        }
+        list = term_get_list_tail(list);
+    }
+    return default_value;
+}
+
+term interop_proplist_get_value(term list, term key)
+{
+    return interop_proplist_get_value_default(list, key, term_nil());
+}
+
+GlobalContext *globalcontext_new()
+{
+    GlobalContext *glb = calloc(1, sizeof(GlobalContext));
+    struct ESP32PlatformData *platform = calloc(1, sizeof(struct ESP32PlatformData));
+    if (IS_NULL_PTR(glb) || IS_NULL_PTR(platform)) {
+        fprintf(stderr, "Out of memory.\n");
+        abort();
+    }
+    list_init(&glb->processes);
+    list_init(&platform->listeners);
+    glb->platform_data = platform;
+
+    if (!event_queue) {
+        event_queue = xQueueCreate(32, sizeof(void *));
+    }
+
+    return glb;
+}
+
+Context *context_new(GlobalContext *glb)
+{
+    Context *ctx = calloc(1, sizeof(Context));
+    if (IS_NULL_PTR(ctx)) {
+        return NULL;
+    }
+    ctx->global = glb;
+    ctx->process_id = ++glb->last_process_id;
+    list_init(&ctx->mailbox);
+    list_append(&glb->processes, &ctx->processes_table_head);
+    return ctx;
+}
+
+Context *globalcontext_get_process(GlobalContext *glb, int local_process_id)
+{
+    struct ListHead *item;
+    LIST_FOR_EACH (item, &glb->processes) {
+        Context *ctx = GET_LIST_ENTRY(item, Context, processes_table_head);
+        if (ctx->process_id == local_process_id) {
+            return ctx;
+        }
+    }
+    return NULL;
+}
+
+void mailbox_send(Context *c, term t)
+{
+    Message *message = malloc(sizeof(Message));
+    if (IS_NULL_PTR(message)) {
+        fprintf(stderr, "Out of memory.\n");
+        abort();
+    }
+    message->message = t;
+    list_append(&c->mailbox, &message->mailbox_list_head);
+}
+
+Message *mailbox_dequeue(Context *c)
+{
+    if (list_is_empty(&c->mailbox)) {
+        return NULL;
+    }
+    Message *message = GET_LIST_ENTRY(c->mailbox.next, Message, mailbox_list_head);
+    list_remove(&message->mailbox_list_head);
+    return message;
+}
+
+int memory_ensure_free(Context *c, int size)
+{
+    UNUSED(c);
+    UNUSED(size);
+
+    return MEMORY_GC_OK;
+}
+
+void sys_consume_pending_events(GlobalContext *glb)
+{
+    struct ESP32PlatformData *platform = glb->platform_data;
+
+    void *sender;
+    if (xQueueReceive(event_queue, &sender, 1) != pdTRUE) {
+        return;
+    }
+
+    struct ListHead *item;
+    struct ListHead *tmp;
+    MUTABLE_LIST_FOR_EACH (item, tmp, &platform->listeners) {
+        EventListener *listener = GET_LIST_ENTRY(item, EventListener, listeners_list_head);
+        if (listener->sender == sender) {
+            listener->handler(listener);
+        }
+    }
+}
@@ -0,0 +1,202 @@
+/*
+ * Rendering benchmark: draws each workload for a number of frames with the
+ * draw call, so that only rasterization is measured, and reports the
+ * throughput from the stats call.
+ *
+ *     bench [frames]
+ *
+ * Every frame changes all the items of the workload, so everything is
+ * redrawn. Heap allocations are counted by wrapping malloc, calloc and
+ * realloc at link time while the port handles the call, they include the
+ * reply tuple and message, two per call.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <defaultatoms.h>
+#include <epd_driver.h>
+
+#include "harness.h"
+#include "testfont.h"
+
+static atomic_uint heap_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+#define PARAGRAPH_LINES 10
+#define PARAGRAPH_LINE_LENGTH 50
+#define GRID_CELL 12
+
+typedef term (*BuildFrame)(TestDisplay *display, int frame);
+
+static uint8_t *photo;
+
+// A smooth gradient with some noise, a stand-in for a photo
+static void build_photo()
+{
+    photo = malloc(EPD_WIDTH * EPD_HEIGHT * 4);
+    uint32_t seed = 1;
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 32;
+            uint8_t *p = &photo[(y * EPD_WIDTH + x) * 4];
+            p[0] = (x * 255 / EPD_WIDTH + noise) & 0xFF;
+            p[1] = (y * 255 / EPD_HEIGHT + noise) & 0xFF;
+            p[2] = ((x + y) * 255 / (EPD_WIDTH + EPD_HEIGHT)) & 0xFF;
+            p[3] = 0xFF;
+        }
+    }
+}
+
+static term photo_frame(TestDisplay *display, int frame)
+{
+    // the first pixel differs between frames, so the item hash changes
+    photo[0] = frame;
+    term items[] = {
+        test_image(display, 0, 0, "rgba8888", EPD_WIDTH, EPD_HEIGHT, photo, EPD_WIDTH * EPD_HEIGHT * 4)
+    };
+    return test_list(display, items, 1);
+}
+
+static term paragraph_frame(TestDisplay *display, int frame, const char *font, int line_height)
+{
+    term items[PARAGRAPH_LINES];
+    for (int i = 0; i < PARAGRAPH_LINES; i++) {
+        char line[PARAGRAPH_LINE_LENGTH + 1];
+        for (int c = 0; c < PARAGRAPH_LINE_LENGTH; c++) {
+            line[c] = 'A' + (i * 7 + c + frame) % 26;
+        }
+        line[PARAGRAPH_LINE_LENGTH] = '\0';
+        items[i] = test_text(display, 20, 20 + i * line_height, font, frame % 2 ? 0x404040 : 0x000000, line);
+    }
+    return test_list(display, items, PARAGRAPH_LINES);
+}
+
+static term builtin_paragraph_frame(TestDisplay *display, int frame)
+{
+    return paragraph_frame(display, frame, "default16px", 16);
+}
+
+static term uncompressed_paragraph_frame(TestDisplay *display, int frame)
+{
+    return paragraph_frame(display, frame, "uncompressed", 20);
+}
+
+static term compressed_paragraph_frame(TestDisplay *display, int frame)
+{
+    return paragraph_frame(display, frame, "compressed", 20);
+}
+
+static term rect_grid_frame(TestDisplay *display, int frame)
+{
+    int columns = EPD_WIDTH / GRID_CELL;
+    int rows = EPD_HEIGHT / GRID_CELL;
+    term *items = malloc(sizeof(term) * columns * rows);
+    for (int y = 0; y < rows; y++) {
+        for (int x = 0; x < columns; x++) {
+            uint32_t color = ((x + y + frame) % 16) * 0x111111;
+            items[y * columns + x] = (x + y) % 2
+                ? test_rect(display, x * GRID_CELL, y * GRID_CELL, GRID_CELL - 2, GRID_CELL - 2, color)
+                : test_fill_rect(display, x * GRID_CELL, y * GRID_CELL, GRID_CELL - 2, GRID_CELL - 2, color);
+        }
+    }
+    term list = test_list(display, items, columns * rows);
+    free(items);
+    return list;
+}
+
+static void register_font(TestDisplay *display, const char *name, bool compressed)
+{
+    size_t size;
+    uint8_t *font = test_font_build(compressed, &size);
+    test_display_call(display, test_tuple(display, 3, test_atom(display, "register_font"),
+        test_atom(display, name), test_binary(display, font, size)));
+    free(font);
+}
+
+static void run(TestDisplay *display, const char *name, BuildFrame build, int frames)
+{
+    uint64_t raster_us = 0;
+    uint64_t pixels = 0;
+    uint64_t glyphs = 0;
+    uint64_t allocs = 0;
+    uint64_t heap = 0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        term list = build(display, frame);
+        term req = test_tuple(display, 2, test_atom(display, "draw"), list);
+
+        uint64_t ref = test_display_post(display, req);
+        unsigned before = atomic_load(&heap_allocs);
+        test_display_run(display);
+        heap += atomic_load(&heap_allocs) - before;
+        CHECK(test_display_wait(display, ref, 10000));
+
+        term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+        raster_us += test_stats_get(display, stats, "raster_us");
+        pixels += test_stats_get(display, stats, "pixels");
+        glyphs += test_stats_get(display, stats, "glyphs");
+        allocs += test_stats_get(display, stats, "allocs");
+    }
+
+    double seconds = raster_us / 1e6;
+    if (seconds <= 0) {
+        seconds = 1e-6;
+    }
+    printf("%-22s %9.2f ms/frame %10.1f Mpixels/s %10.0f glyphs/s %7.1f allocs/frame %7.1f heap allocs/frame\n",
+        name, raster_us / 1e3 / frames, pixels / seconds / 1e6, glyphs / seconds, (double) allocs / frames,
+        (double) heap / frames);
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 20;
+    if (frames < 1) {
+        fprintf(stderr, "usage: bench [frames]\n");
+        return 1;
+    }
+
+    TestDisplay display;
+    test_display_init(&display);
+    term opts[] = { test_tuple(&display, 2, test_atom(&display, "clear_on_start"), FALSE_ATOM) };
+    if (!test_display_open(&display, test_list(&display, opts, 1))) {
+        fprintf(stderr, "failed to open the display\n");
+        return 1;
+    }
+    register_font(&display, "uncompressed", false);
+    register_font(&display, "compressed", true);
+    build_photo();
+
+    run(&display, "rgba8888 photo", photo_frame, frames);
+    run(&display, "8x16 paragraph", builtin_paragraph_frame, frames);
+    run(&display, "uncompressed paragraph", uncompressed_paragraph_frame, frames);
+    run(&display, "compressed paragraph", compressed_paragraph_frame, frames);
+    run(&display, "rect grid", rect_grid_frame, frames);
+
+    free(photo);
+    return 0;
+}
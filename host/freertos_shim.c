@@ -0,0 +1,173 @@
+/*
+ * Host build: FreeRTOS queues and tasks on pthreads.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+struct HostQueue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct HostQueue *queue = calloc(1, sizeof(struct HostQueue) + length * item_size);
+    if (!queue) {
+        return NULL;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&queue->mutex, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+// Wait for a change of queue with its mutex held, returns false once the ticks are over
+static bool wait_change(struct HostQueue *queue, TickType_t ticks_to_wait, const struct timespec *deadline)
+{
+    if (ticks_to_wait == 0) {
+        return false;
+    }
+    if (ticks_to_wait == portMAX_DELAY) {
+        pthread_cond_wait(&queue->changed, &queue->mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(&queue->changed, &queue->mutex, deadline) != ETIMEDOUT;
+}
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (ticks != portMAX_DELAY) {
+        deadline.tv_sec += ticks / 1000;
+        deadline.tv_nsec += (long) (ticks % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    return deadline;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!wait_change(queue, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFAIL;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    if (queue->item_size) {
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) {
+        if (!wait_change(queue, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+    if (queue->item_size) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdTRUE;
+}
+
+struct TaskStart
+{
+    TaskFunction_t task;
+    void *arg;
+};
+
+static void *run_task(void *arg)
+{
+    struct TaskStart start = *(struct TaskStart *) arg;
+    free(arg);
+    start.task(start.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth,
+    void *arg, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    (void) name;
+    (void) stack_depth;
+    (void) priority;
+    (void) core_id;
+
+    struct TaskStart *start = malloc(sizeof(struct TaskStart));
+    if (!start) {
+        return pdFAIL;
+    }
+    start->task = task;
+    start->arg = arg;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_task, start)) {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (created_task) {
+        *created_task = (TaskHandle_t) thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec delay = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long) (ticks % 1000) * 1000000
+    };
+    nanosleep(&delay, NULL);
+}
+
+int64_t esp_timer_get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,172 @@
+#include "harness.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <mailbox.h>
+#include <sys.h>
+
+#include "display.h"
+
+void test_display_init(TestDisplay *display)
+{
+    display->global = globalcontext_new();
+    display->caller = context_new(display->global);
+    display->port = NULL;
+    display->last_ref = 0;
+}
+
+bool test_display_open(TestDisplay *display, term opts)
+{
+    display->port = display_create_port(display->global, opts);
+    return display->port != NULL;
+}
+
+uint64_t test_display_post(TestDisplay *display, term req)
+{
+    uint64_t ref = ++display->last_ref;
+    term from = test_tuple(display, 2, term_from_local_process_id(display->caller->process_id),
+        term_from_ref_ticks(ref, display->caller));
+
+    mailbox_send(display->port, test_tuple(display, 3, test_atom(display, "$call"), from, req));
+    return ref;
+}
+
+void test_display_run(TestDisplay *display)
+{
+    display->port->native_handler(display->port);
+}
+
+uint64_t test_display_send(TestDisplay *display, term req)
+{
+    uint64_t ref = test_display_post(display, req);
+    test_display_run(display);
+    return ref;
+}
+
+// Take the reply to ref out of the caller mailbox, leaving the other messages there
+static bool take_reply(TestDisplay *display, uint64_t ref, term *reply)
+{
+    struct ListHead *item;
+    LIST_FOR_EACH (item, &display->caller->mailbox) {
+        Message *message = GET_LIST_ENTRY(item, Message, mailbox_list_head);
+        term from = term_get_tuple_element(message->message, 1);
+        if (term_to_ref_ticks(term_get_tuple_element(from, 1)) == ref) {
+            *reply = term_get_tuple_element(message->message, 2);
+            list_remove(item);
+            free(message);
+            return true;
+        }
+    }
+    return false;
+}
+
+term test_display_wait(TestDisplay *display, uint64_t ref, int timeout_ms)
+{
+    int64_t deadline = esp_timer_get_time() + (int64_t) timeout_ms * 1000;
+
+    term reply;
+    while (!take_reply(display, ref, &reply)) {
+        if (esp_timer_get_time() > deadline) {
+            return 0;
+        }
+        sys_consume_pending_events(display->global);
+    }
+    return reply;
+}
+
+term test_display_call(TestDisplay *display, term req)
+{
+    term reply = test_display_wait(display, test_display_send(display, req), 10000);
+    if (!reply) {
+        fprintf(stderr, "no reply to: ");
+        term_display(stderr, req, display->caller);
+        fprintf(stderr, "\n");
+        abort();
+    }
+    return reply;
+}
+
+int64_t test_stats_get(TestDisplay *display, term stats, const char *key)
+{
+    term key_atom = test_atom(display, key);
+    while (term_is_nonempty_list(stats)) {
+        term item = term_get_list_head(stats);
+        if (term_get_tuple_element(item, 0) == key_atom) {
+            return term_to_int(term_get_tuple_element(item, 1));
+        }
+        stats = term_get_list_tail(stats);
+    }
+    return -1;
+}
+
+term test_atom(TestDisplay *display, const char *name)
+{
+    char atom_string[256];
+    size_t len = strlen(name);
+    if (len > 255) {
+        abort();
+    }
+    atom_string[0] = len;
+    memcpy(atom_string + 1, name, len);
+    return context_make_atom(display->caller, atom_string);
+}
+
+term test_tuple(TestDisplay *display, int arity, ...)
+{
+    term t = term_alloc_tuple(arity, display->caller);
+
+    va_list elements;
+    va_start(elements, arity);
+    for (int i = 0; i < arity; i++) {
+        term_put_tuple_element(t, i, va_arg(elements, term));
+    }
+    va_end(elements);
+
+    return t;
+}
+
+term test_list(TestDisplay *display, const term *items, int len)
+{
+    term list = term_nil();
+    for (int i = len - 1; i >= 0; i--) {
+        list = term_list_prepend(items[i], list, display->caller);
+    }
+    return list;
+}
+
+term test_binary(TestDisplay *display, const void *data, uint32_t size)
+{
+    return term_from_literal_binary(data, size, display->caller);
+}
+
+term test_fill_rect(TestDisplay *display, int x, int y, int width, int height, uint32_t color)
+{
+    return test_tuple(display, 6, test_atom(display, "fill_rect"), term_from_int(x), term_from_int(y),
+        term_from_int(width), term_from_int(height), term_from_int(color));
+}
+
+term test_rect(TestDisplay *display, int x, int y, int width, int height, uint32_t color)
+{
+    return test_tuple(display, 6, test_atom(display, "rect"), term_from_int(x), term_from_int(y),
+        term_from_int(width), term_from_int(height), term_from_int(color));
+}
+
+term test_text(TestDisplay *display, int x, int y, const char *font, uint32_t color, const char *text)
+{
+    return test_tuple(display, 7, test_atom(display, "text"), term_from_int(x), term_from_int(y),
+        test_atom(display, font), term_from_int(color), test_atom(display, "transparent"),
+        test_binary(display, text, strlen(text)));
+}
+
+term test_image(TestDisplay *display, int x, int y, const char *format, int width, int height,
+    const void *data, uint32_t size)
+{
+    term img = test_tuple(display, 4, test_atom(display, format), term_from_int(width), term_from_int(height),
+        test_binary(display, data, size));
+    return test_tuple(display, 5, test_atom(display, "image"), term_from_int(x), term_from_int(y),
+        term_from_int(0xFFFFFF), img);
+}
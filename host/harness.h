@@ -0,0 +1,91 @@
+/*
+ * Host build: drive the display port like an Erlang process would, with
+ * gen_server calls, and build the terms they need.
+ */
+
+#ifndef _HARNESS_H_
+#define _HARNESS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <context.h>
+#include <globalcontext.h>
+#include <term.h>
+
+typedef struct
+{
+    GlobalContext *global;
+    Context *port;
+    // the process the replies are sent to
+    Context *caller;
+    uint64_t last_ref;
+} TestDisplay;
+
+/**
+ * Create the caller process, terms can be built from then on.
+ */
+void test_display_init(TestDisplay *display);
+
+/**
+ * Start a display port with the given options proplist, the default is
+ * term_nil(). Returns false when display_create_port fails.
+ */
+bool test_display_open(TestDisplay *display, term opts);
+
+/**
+ * Put {'$call', {Caller, Ref}, req} in the port mailbox without running the
+ * port. Returns the reference, to wait for the reply.
+ */
+uint64_t test_display_post(TestDisplay *display, term req);
+
+/**
+ * Let the port handle its mailbox.
+ */
+void test_display_run(TestDisplay *display);
+
+/**
+ * test_display_post followed by test_display_run.
+ */
+uint64_t test_display_send(TestDisplay *display, term req);
+
+/**
+ * Wait up to timeout_ms for the reply to the call ref, delivering refresh
+ * events to the port meanwhile. Returns 0 on timeout, which is not a term.
+ */
+term test_display_wait(TestDisplay *display, uint64_t ref, int timeout_ms);
+
+/**
+ * test_display_send followed by test_display_wait with a 10 s timeout,
+ * aborting when there is no reply.
+ */
+term test_display_call(TestDisplay *display, term req);
+
+/**
+ * Value of key in the proplist returned by the stats call, -1 if missing.
+ */
+int64_t test_stats_get(TestDisplay *display, term stats, const char *key);
+
+term test_atom(TestDisplay *display, const char *name);
+term test_tuple(TestDisplay *display, int arity, ...);
+term test_list(TestDisplay *display, const term *items, int len);
+term test_binary(TestDisplay *display, const void *data, uint32_t size);
+
+/**
+ * {fill_rect, X, Y, Width, Height, Color} and friends.
+ */
+term test_fill_rect(TestDisplay *display, int x, int y, int width, int height, uint32_t color);
+term test_rect(TestDisplay *display, int x, int y, int width, int height, uint32_t color);
+term test_text(TestDisplay *display, int x, int y, const char *font, uint32_t color, const char *text);
+term test_image(TestDisplay *display, int x, int y, const char *format, int width, int height,
+    const void *data, uint32_t size);
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                   \
+        }                                                                              \
+    } while (0)
+
+#endif
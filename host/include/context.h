@@ -0,0 +1,27 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include "globalcontext.h"
+#include "list.h"
+#include "term.h"
+
+typedef void (*native_handler)(Context *ctx);
+
+struct Context
+{
+    struct ListHead processes_table_head;
+    GlobalContext *global;
+    int process_id;
+    struct ListHead mailbox;
+    native_handler native_handler;
+    void *platform_data;
+};
+
+Context *context_new(GlobalContext *glb);
+
+/**
+ * Intern a length prefixed atom string, such as "\x2" "ok".
+ */
+term context_make_atom(Context *ctx, AtomString string);
+
+#endif
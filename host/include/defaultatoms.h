@@ -0,0 +1,18 @@
+#ifndef _DEFAULTATOMS_H_
+#define _DEFAULTATOMS_H_
+
+#include "term.h"
+
+#define FALSE_ATOM_INDEX 0
+#define TRUE_ATOM_INDEX 1
+#define OK_ATOM_INDEX 2
+#define ERROR_ATOM_INDEX 3
+#define UNDEFINED_ATOM_INDEX 4
+
+#define FALSE_ATOM term_from_atom_index(FALSE_ATOM_INDEX)
+#define TRUE_ATOM term_from_atom_index(TRUE_ATOM_INDEX)
+#define OK_ATOM term_from_atom_index(OK_ATOM_INDEX)
+#define ERROR_ATOM term_from_atom_index(ERROR_ATOM_INDEX)
+#define UNDEFINED_ATOM term_from_atom_index(UNDEFINED_ATOM_INDEX)
+
+#endif
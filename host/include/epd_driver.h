@@ -0,0 +1,87 @@
+/*
+ * Host build: the epdiy v1 driver API, backed by the in-memory panel of
+ * mock_epd.c. See mock_epd.h for the test controls.
+ */
+
+#ifndef _EPD_DRIVER_H_
+#define _EPD_DRIVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ED047TC1, the epdiy default
+#define EPD_WIDTH 960
+#define EPD_HEIGHT 540
+
+typedef struct
+{
+    int x;
+    int y;
+    int width;
+    int height;
+} EpdRect;
+
+enum EpdDrawMode
+{
+    MODE_INIT = 0x0,
+    MODE_DU = 0x1,
+    MODE_GC16 = 0x2,
+    MODE_GC16_FAST = 0x3,
+    MODE_A2 = 0x4,
+    MODE_GL16 = 0x5,
+    MODE_GL16_FAST = 0x6,
+    MODE_DU4 = 0x7,
+    MODE_GL4 = 0xA,
+    MODE_GL16_INV = 0xB
+};
+
+enum EpdDrawError
+{
+    EPD_DRAW_SUCCESS = 0x0,
+    EPD_DRAW_INVALID_PACKING_MODE = 0x1,
+    EPD_DRAW_LOOKUP_NOT_IMPLEMENTED = 0x2,
+    EPD_DRAW_STRING_INVALID = 0x4,
+    EPD_DRAW_NO_DRAWABLE_CHARACTERS = 0x8,
+    EPD_DRAW_FAILED_ALLOC = 0x10,
+    EPD_DRAW_GLYPH_FALLBACK_FAILED = 0x20,
+    EPD_DRAW_INVALID_CROP = 0x40,
+    EPD_DRAW_MODE_NOT_FOUND = 0x80,
+    EPD_DRAW_NO_PHASES_AVAILABLE = 0x100,
+    EPD_DRAW_INVALID_FONT_FLAGS = 0x200
+};
+
+enum EpdInitOptions
+{
+    EPD_OPTIONS_DEFAULT = 0,
+    EPD_LUT_1K = 1,
+    EPD_LUT_64K = 2,
+    EPD_FEED_QUEUE_8 = 4,
+    EPD_FEED_QUEUE_32 = 8
+};
+
+enum EpdRotation
+{
+    EPD_ROT_LANDSCAPE = 0,
+    EPD_ROT_PORTRAIT = 1,
+    EPD_ROT_INVERTED_LANDSCAPE = 2,
+    EPD_ROT_INVERTED_PORTRAIT = 3
+};
+
+void epd_init(enum EpdInitOptions options);
+void epd_deinit();
+void epd_poweron();
+void epd_poweroff();
+void epd_clear();
+void epd_clear_area(EpdRect area);
+EpdRect epd_full_screen();
+int epd_ambient_temperature();
+
+void epd_set_rotation(enum EpdRotation rotation);
+enum EpdRotation epd_get_rotation();
+
+void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer);
+void epd_draw_hline(int x, int y, int length, uint8_t color, uint8_t *framebuffer);
+void epd_draw_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer);
+void epd_fill_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _EPD_HIGHLEVEL_H_
+#define _EPD_HIGHLEVEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "epd_driver.h"
+
+typedef struct EpdWaveform EpdWaveform;
+
+extern const EpdWaveform epdiy_ED047TC1;
+#define EPD_BUILTIN_WAVEFORM (&epdiy_ED047TC1)
+
+typedef struct
+{
+    uint8_t *back_fb;
+    uint8_t *front_fb;
+    uint8_t *difference_fb;
+    bool *dirty_lines;
+    const EpdWaveform *waveform;
+} EpdiyHighlevelState;
+
+EpdiyHighlevelState epd_hl_init(const EpdWaveform *waveform);
+uint8_t *epd_hl_get_framebuffer(EpdiyHighlevelState *state);
+enum EpdDrawError epd_hl_update_screen(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature);
+enum EpdDrawError epd_hl_update_area(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature,
+    EpdRect area);
+void epd_hl_set_all_white(EpdiyHighlevelState *state);
+
+#endif
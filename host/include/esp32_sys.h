@@ -0,0 +1,18 @@
+#ifndef _ESP32_SYS_H_
+#define _ESP32_SYS_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "list.h"
+#include "sys.h"
+
+// senders of events, as void * items
+extern QueueHandle_t event_queue;
+
+struct ESP32PlatformData
+{
+    struct ListHead listeners;
+};
+
+#endif
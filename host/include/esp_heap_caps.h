@@ -0,0 +1,18 @@
+#ifndef _ESP_HEAP_CAPS_H_
+#define _ESP_HEAP_CAPS_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+// the host has a single heap
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void) caps;
+    return malloc(size);
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _ESP_TIMER_H_
+#define _ESP_TIMER_H_
+
+#include <stdint.h>
+
+/**
+ * Microseconds of CLOCK_MONOTONIC.
+ */
+int64_t esp_timer_get_time();
+
+#endif
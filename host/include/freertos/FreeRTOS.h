@@ -0,0 +1,34 @@
+/*
+ * Host build: FreeRTOS tasks, queues and semaphores on top of pthreads,
+ * with a 1 ms tick.
+ */
+
+#ifndef _FREERTOS_H_
+#define _FREERTOS_H_
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFFu)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+// the raster workers size their arrays with it, so it has to be a constant
+#define portNUM_PROCESSORS 2
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef struct HostQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *arg);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _FREERTOS_QUEUE_H_
+#define _FREERTOS_QUEUE_H_
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _FREERTOS_SEMPHR_H_
+#define _FREERTOS_SEMPHR_H_
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+// like on FreeRTOS, a binary semaphore is a queue of one empty item
+#define xSemaphoreCreateBinary() xQueueCreate(1, 0)
+#define xSemaphoreGive(semaphore) xQueueSend((semaphore), NULL, 0)
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive((semaphore), NULL, (ticks_to_wait))
+
+#endif
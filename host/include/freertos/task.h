@@ -0,0 +1,15 @@
+#ifndef _FREERTOS_TASK_H_
+#define _FREERTOS_TASK_H_
+
+#include "FreeRTOS.h"
+
+/**
+ * Start task on a new detached thread, the stack size, priority and core
+ * are ignored.
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth,
+    void *arg, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+
+void vTaskDelay(TickType_t ticks);
+
+#endif
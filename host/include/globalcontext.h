@@ -0,0 +1,23 @@
+#ifndef _GLOBALCONTEXT_H_
+#define _GLOBALCONTEXT_H_
+
+#include <stddef.h>
+
+#include "list.h"
+#include "term.h"
+
+typedef const void *AtomString;
+
+struct GlobalContext
+{
+    struct ListHead processes;
+    int last_process_id;
+    void *platform_data;
+};
+
+GlobalContext *globalcontext_new();
+Context *globalcontext_get_process(GlobalContext *glb, int local_process_id);
+AtomString globalcontext_atomstring_from_term(GlobalContext *glb, term t);
+void atom_string_to_c(AtomString atom_string, char *buf, size_t bufsize);
+
+#endif
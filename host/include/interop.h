@@ -0,0 +1,15 @@
+#ifndef _INTEROP_H_
+#define _INTEROP_H_
+
+#include "term.h"
+
+/**
+ * Copy a charlist or a binary to a new null terminated string, NULL when t
+ * is neither.
+ */
+char *interop_term_to_string(term t, int *ok);
+
+term interop_proplist_get_value(term list, term key);
+term interop_proplist_get_value_default(term list, term key, term default_value);
+
+#endif
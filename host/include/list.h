@@ -0,0 +1,44 @@
+#ifndef _LIST_H_
+#define _LIST_H_
+
+struct ListHead
+{
+    struct ListHead *next;
+    struct ListHead *prev;
+};
+
+#define GET_LIST_ENTRY(list_item, type, list_head_member) \
+    ((type *) (((char *) (list_item)) - ((unsigned long) &((type *) 0)->list_head_member)))
+
+#define LIST_FOR_EACH(item, head) \
+    for (item = (head)->next; item != (head); item = item->next)
+
+#define MUTABLE_LIST_FOR_EACH(item, tmp, head) \
+    for (item = (head)->next, tmp = item->next; item != (head); item = tmp, tmp = item->next)
+
+static inline void list_init(struct ListHead *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_append(struct ListHead *head, struct ListHead *new_item)
+{
+    new_item->prev = head->prev;
+    new_item->next = head;
+    head->prev->next = new_item;
+    head->prev = new_item;
+}
+
+static inline void list_remove(struct ListHead *item)
+{
+    item->prev->next = item->next;
+    item->next->prev = item->prev;
+}
+
+static inline int list_is_empty(struct ListHead *list)
+{
+    return list->next == list;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+
+#include "context.h"
+#include "list.h"
+#include "term.h"
+
+#define MEMORY_GC_OK 0
+
+typedef struct Message
+{
+    struct ListHead mailbox_list_head;
+    term message;
+} Message;
+
+/**
+ * Append message to the mailbox of c. Messages are not copied, terms are
+ * shared by every process.
+ */
+void mailbox_send(Context *c, term t);
+
+/**
+ * Remove the first message of the mailbox of c, it is freed with free().
+ */
+Message *mailbox_dequeue(Context *c);
+
+int memory_ensure_free(Context *c, int size);
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Host build: the tinfl entry point used by ufontlib, implemented with zlib.
+ * Only whole buffer decompression with TINFL_FLAG_PARSE_ZLIB_HEADER and
+ * TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF is supported.
+ */
+
+#ifndef _MINIZ_H_
+#define _MINIZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+
+typedef enum
+{
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0
+} tinfl_status;
+
+typedef struct
+{
+    int unused;
+} tinfl_decompressor;
+
+#define tinfl_init(r) ((void) (r))
+
+static inline tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_buf, size_t *in_buf_size,
+    uint8_t *out_buf_start, uint8_t *out_buf_next, size_t *out_buf_size, uint32_t flags)
+{
+    (void) r;
+    (void) out_buf_start;
+    (void) flags;
+
+    uLongf out_size = *out_buf_size;
+    uLong in_size = *in_buf_size;
+    int result = uncompress2(out_buf_next, &out_size, in_buf, &in_size);
+    *out_buf_size = out_size;
+    *in_buf_size = in_size;
+    return result == Z_OK ? TINFL_STATUS_DONE : TINFL_STATUS_FAILED;
+}
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Controls of the host epdiy backend.
+ *
+ * The panel is an EPD_WIDTH x EPD_HEIGHT 4bpp buffer in the epdiy layout.
+ * Highlevel updates copy the changed part of the front buffer to it, each
+ * update or clear counting as one waveform pass. The panel only changes
+ * once the configured waveform delay is over and waveforms are not held.
+ */
+
+#ifndef _MOCK_EPD_H_
+#define _MOCK_EPD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "epd_driver.h"
+
+typedef struct
+{
+    uint32_t power_ons;
+    uint32_t clears;
+    // epd_hl_update_screen and epd_hl_update_area calls
+    uint32_t passes;
+    uint32_t du_passes;
+    uint32_t gl16_passes;
+    uint32_t gc16_passes;
+    // pixels covered by the updated areas
+    uint64_t pixels;
+    // updates or clears done while the panel was powered off
+    uint32_t unpowered_passes;
+} MockEpdStats;
+
+void mock_epd_get_stats(MockEpdStats *stats);
+void mock_epd_reset_stats();
+
+/**
+ * Make every pass and clear take us microseconds, like a real waveform.
+ */
+void mock_epd_set_waveform_delay_us(uint32_t us);
+
+/**
+ * While held, passes and clears wait before changing the panel, until
+ * mock_epd_hold_waveforms(false) releases them.
+ */
+void mock_epd_hold_waveforms(bool held);
+
+bool mock_epd_is_powered();
+
+/**
+ * What is shown on the panel.
+ */
+const uint8_t *mock_epd_panel();
+
+/**
+ * Write the panel to path as a binary 8 bit PGM.
+ */
+bool mock_epd_dump_pgm(const char *path);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _SYS_H_
+#define _SYS_H_
+
+#include "globalcontext.h"
+#include "list.h"
+
+typedef struct EventListener EventListener;
+
+typedef void (*event_handler_t)(EventListener *listener);
+
+struct EventListener
+{
+    struct ListHead listeners_list_head;
+    event_handler_t handler;
+    void *data;
+    void *sender;
+};
+
+/**
+ * Wait up to one tick for an event posted to event_queue and call the
+ * listeners registered for its sender.
+ */
+void sys_consume_pending_events(GlobalContext *glb);
+
+#endif
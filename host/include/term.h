@@ -0,0 +1,233 @@
+/*
+ * Host build: the subset of the AtomVM term API used by the display port.
+ *
+ * Terms are tagged words. Immediates (small integers, atoms, pids and nil)
+ * carry their value, tuples, binaries and references point to a boxed
+ * object and lists to a cons cell. Boxed objects and cons cells are never
+ * garbage collected, they live until the process exits.
+ */
+
+#ifndef _TERM_H_
+#define _TERM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+typedef uintptr_t term;
+typedef intptr_t avm_int_t;
+typedef int64_t avm_int64_t;
+
+typedef struct Context Context;
+typedef struct GlobalContext GlobalContext;
+
+// sizes in terms, only used by memory_ensure_free which always succeeds
+#define TUPLE_SIZE(elems) ((int) (elems) + 1)
+#define CONS_SIZE 2
+#define REF_SIZE 3
+
+#define TERM_TAG_MASK 0x3
+#define TERM_LIST_TAG 0x1
+#define TERM_BOXED_TAG 0x2
+#define TERM_IMMEDIATE_TAG 0x3
+
+#define TERM_IMMEDIATE_MASK 0xF
+#define TERM_PID_TAG 0x3
+#define TERM_ATOM_TAG 0x7
+#define TERM_INTEGER_TAG 0xB
+#define TERM_NIL 0xF
+
+enum TermBoxedKind
+{
+    TERM_BOXED_TUPLE,
+    TERM_BOXED_BINARY,
+    TERM_BOXED_REF
+};
+
+struct TermBoxed
+{
+    enum TermBoxedKind kind;
+    int size;
+    union
+    {
+        term elements[1];
+        char data[1];
+        uint64_t ref_ticks;
+    };
+};
+
+struct TermCons
+{
+    term head;
+    term tail;
+};
+
+static inline struct TermBoxed *term_boxed(term t)
+{
+    return (struct TermBoxed *) (t & ~(term) TERM_TAG_MASK);
+}
+
+static inline struct TermCons *term_cons(term t)
+{
+    return (struct TermCons *) (t & ~(term) TERM_TAG_MASK);
+}
+
+static inline bool term_is_boxed_kind(term t, enum TermBoxedKind kind)
+{
+    return (t & TERM_TAG_MASK) == TERM_BOXED_TAG && term_boxed(t)->kind == kind;
+}
+
+static inline term term_nil()
+{
+    return TERM_NIL;
+}
+
+static inline bool term_is_nil(term t)
+{
+    return t == TERM_NIL;
+}
+
+static inline bool term_is_nonempty_list(term t)
+{
+    return (t & TERM_TAG_MASK) == TERM_LIST_TAG;
+}
+
+static inline bool term_is_list(term t)
+{
+    return term_is_nil(t) || term_is_nonempty_list(t);
+}
+
+static inline bool term_is_tuple(term t)
+{
+    return term_is_boxed_kind(t, TERM_BOXED_TUPLE);
+}
+
+static inline bool term_is_binary(term t)
+{
+    return term_is_boxed_kind(t, TERM_BOXED_BINARY);
+}
+
+static inline bool term_is_reference(term t)
+{
+    return term_is_boxed_kind(t, TERM_BOXED_REF);
+}
+
+static inline bool term_is_integer(term t)
+{
+    return (t & TERM_IMMEDIATE_MASK) == TERM_INTEGER_TAG;
+}
+
+static inline bool term_is_atom(term t)
+{
+    return (t & TERM_IMMEDIATE_MASK) == TERM_ATOM_TAG;
+}
+
+static inline bool term_is_pid(term t)
+{
+    return (t & TERM_IMMEDIATE_MASK) == TERM_PID_TAG;
+}
+
+static inline term term_from_int(avm_int_t value)
+{
+    return ((term) value << 4) | TERM_INTEGER_TAG;
+}
+
+/*
+ * Range of small integers on the 32 bit devices, where 4 of the bits are the
+ * tag, rather than on the host. Larger values would have to be boxed.
+ */
+#define MAX_NOT_BOXED_INT ((avm_int_t) ((1 << 27) - 1))
+#define MIN_NOT_BOXED_INT ((avm_int_t) -(1 << 27))
+
+static inline term term_from_int32(int32_t value)
+{
+    // on a device the value would silently wrap
+    if (value > MAX_NOT_BOXED_INT || value < MIN_NOT_BOXED_INT) {
+        fprintf(stderr, "term_from_int32: %d is not a small integer\n", (int) value);
+        abort();
+    }
+    return term_from_int(value);
+}
+
+static inline avm_int_t term_to_int(term t)
+{
+    return (avm_int_t) t >> 4;
+}
+
+static inline int32_t term_to_int32(term t)
+{
+    return (int32_t) term_to_int(t);
+}
+
+static inline term term_from_atom_index(int index)
+{
+    return ((term) index << 4) | TERM_ATOM_TAG;
+}
+
+static inline int term_to_atom_index(term t)
+{
+    return (int) (t >> 4);
+}
+
+static inline term term_from_local_process_id(int local_process_id)
+{
+    return ((term) local_process_id << 4) | TERM_PID_TAG;
+}
+
+static inline int term_to_local_process_id(term t)
+{
+    return (int) (t >> 4);
+}
+
+static inline int term_get_tuple_arity(term t)
+{
+    return term_boxed(t)->size;
+}
+
+static inline term term_get_tuple_element(term t, int index)
+{
+    return term_boxed(t)->elements[index];
+}
+
+static inline void term_put_tuple_element(term t, int index, term value)
+{
+    term_boxed(t)->elements[index] = value;
+}
+
+static inline term term_get_list_head(term t)
+{
+    return term_cons(t)->head;
+}
+
+static inline term term_get_list_tail(term t)
+{
+    return term_cons(t)->tail;
+}
+
+static inline const char *term_binary_data(term t)
+{
+    return term_boxed(t)->data;
+}
+
+static inline int term_binary_size(term t)
+{
+    return term_boxed(t)->size;
+}
+
+static inline uint64_t term_to_ref_ticks(term t)
+{
+    return term_boxed(t)->ref_ticks;
+}
+
+term term_alloc_tuple(int arity, Context *ctx);
+term term_list_prepend(term head, term tail, Context *ctx);
+term term_from_literal_binary(const void *data, uint32_t size, Context *ctx);
+term term_from_ref_ticks(uint64_t ref_ticks, Context *ctx);
+int term_list_length(term t, int *proper);
+void term_display(FILE *fd, term t, const Context *ctx);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Host build: an in-memory epdiy panel, see mock_epd.h.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epd_driver.h>
+#include <epd_highlevel.h>
+#include <freertos/task.h>
+
+#include "mock_epd.h"
+
+#define FB_SIZE (EPD_WIDTH / 2 * EPD_HEIGHT)
+
+struct EpdWaveform
+{
+    int unused;
+};
+
+const EpdWaveform epdiy_ED047TC1;
+
+static uint8_t panel[FB_SIZE];
+static bool powered;
+static enum EpdRotation rotation;
+static uint32_t waveform_delay_us;
+static MockEpdStats stats;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool hold;
+static pthread_mutex_t hold_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hold_cond = PTHREAD_COND_INITIALIZER;
+
+void mock_epd_get_stats(MockEpdStats *out)
+{
+    pthread_mutex_lock(&stats_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void mock_epd_reset_stats()
+{
+    pthread_mutex_lock(&stats_mutex);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void mock_epd_set_waveform_delay_us(uint32_t us)
+{
+    waveform_delay_us = us;
+}
+
+void mock_epd_hold_waveforms(bool held)
+{
+    pthread_mutex_lock(&hold_mutex);
+    hold = held;
+    pthread_cond_broadcast(&hold_cond);
+    pthread_mutex_unlock(&hold_mutex);
+}
+
+bool mock_epd_is_powered()
+{
+    return powered;
+}
+
+const uint8_t *mock_epd_panel()
+{
+    return panel;
+}
+
+bool mock_epd_dump_pgm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    fprintf(f, "P5\n%d %d\n255\n", EPD_WIDTH, EPD_HEIGHT);
+    static uint8_t line[EPD_WIDTH];
+    for (int y = 0; y < EPD_HEIGHT; y++) {
+        for (int x = 0; x < EPD_WIDTH; x++) {
+            uint8_t byte = panel[y * EPD_WIDTH / 2 + x / 2];
+            line[x] = ((x % 2) ? byte >> 4 : byte & 0x0F) * 0x11;
+        }
+        fwrite(line, 1, EPD_WIDTH, f);
+    }
+    return fclose(f) == 0;
+}
+
+// Account for a waveform pass over pixels and wait for it, the panel changes at the end
+static void waveform_pass(enum EpdDrawMode mode, int pixels, bool clear)
+{
+    pthread_mutex_lock(&stats_mutex);
+    if (clear) {
+        stats.clears++;
+    } else {
+        stats.passes++;
+        stats.pixels += pixels;
+        if (mode == MODE_DU) {
+            stats.du_passes++;
+        } else if (mode == MODE_GL16) {
+            stats.gl16_passes++;
+        } else if (mode == MODE_GC16) {
+            stats.gc16_passes++;
+        }
+    }
+    if (!powered) {
+        stats.unpowered_passes++;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    pthread_mutex_lock(&hold_mutex);
+    while (hold) {
+        pthread_cond_wait(&hold_cond, &hold_mutex);
+    }
+    pthread_mutex_unlock(&hold_mutex);
+
+    if (waveform_delay_us) {
+        vTaskDelay(pdMS_TO_TICKS((waveform_delay_us + 999) / 1000));
+    }
+}
+
+void epd_init(enum EpdInitOptions options)
+{
+    (void) options;
+    memset(panel, 0xFF, FB_SIZE);
+    powered = false;
+}
+
+void epd_deinit()
+{
+}
+
+void epd_poweron()
+{
+    powered = true;
+    pthread_mutex_lock(&stats_mutex);
+    stats.power_ons++;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void epd_poweroff()
+{
+    powered = false;
+}
+
+void epd_clear_area(EpdRect area)
+{
+    waveform_pass(MODE_GC16, area.width * area.height, true);
+    for (int y = area.y; y < area.y + area.height; y++) {
+        for (int x = area.x; x < area.x + area.width; x++) {
+            epd_draw_pixel(x, y, 0xFF, panel);
+        }
+    }
+}
+
+void epd_clear()
+{
+    epd_clear_area(epd_full_screen());
+}
+
+EpdRect epd_full_screen()
+{
+    EpdRect area = { .x = 0, .y = 0, .width = EPD_WIDTH, .height = EPD_HEIGHT };
+    return area;
+}
+
+int epd_ambient_temperature()
+{
+    return 22;
+}
+
+void epd_set_rotation(enum EpdRotation r)
+{
+    rotation = r;
+}
+
+enum EpdRotation epd_get_rotation()
+{
+    return rotation;
+}
+
+void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer)
+{
+    if (x < 0 || x >= EPD_WIDTH || y < 0 || y >= EPD_HEIGHT) {
+        return;
+    }
+    uint8_t *byte = &framebuffer[y * EPD_WIDTH / 2 + x / 2];
+    if (x % 2) {
+        *byte = (*byte & 0x0F) | (color & 0xF0);
+    } else {
+        *byte = (*byte & 0xF0) | (color >> 4);
+    }
+}
+
+void epd_draw_hline(int x, int y, int length, uint8_t color, uint8_t *framebuffer)
+{
+    for (int i = 0; i < length; i++) {
+        epd_draw_pixel(x + i, y, color, framebuffer);
+    }
+}
+
+void epd_draw_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer)
+{
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        epd_draw_pixel(rect.x, y, color, framebuffer);
+        epd_draw_pixel(rect.x + rect.width - 1, y, color, framebuffer);
+    }
+    epd_draw_hline(rect.x, rect.y, rect.width, color, framebuffer);
+    epd_draw_hline(rect.x, rect.y + rect.height - 1, rect.width, color, framebuffer);
+}
+
+void epd_fill_rect(EpdRect rect, uint8_t color, uint8_t *framebuffer)
+{
+    for (int y = rect.y; y < rect.y + rect.height; y++) {
+        epd_draw_hline(rect.x, y, rect.width, color, framebuffer);
+    }
+}
+
+EpdiyHighlevelState epd_hl_init(const EpdWaveform *waveform)
+{
+    EpdiyHighlevelState state = {
+        .back_fb = malloc(FB_SIZE),
+        .front_fb = malloc(FB_SIZE),
+        .difference_fb = NULL,
+        .dirty_lines = NULL,
+        .waveform = waveform
+    };
+    if (!state.back_fb || !state.front_fb) {
+        fprintf(stderr, "Failed to allocate the epdiy framebuffers.\n");
+        abort();
+    }
+    memset(state.back_fb, 0xFF, FB_SIZE);
+    memset(state.front_fb, 0xFF, FB_SIZE);
+    return state;
+}
+
+uint8_t *epd_hl_get_framebuffer(EpdiyHighlevelState *state)
+{
+    return state->front_fb;
+}
+
+enum EpdDrawError epd_hl_update_area(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature,
+    EpdRect area)
+{
+    (void) temperature;
+
+    int x0 = area.x < 0 ? 0 : area.x;
+    int y0 = area.y < 0 ? 0 : area.y;
+    int x1 = area.x + area.width > EPD_WIDTH ? EPD_WIDTH : area.x + area.width;
+    int y1 = area.y + area.height > EPD_HEIGHT ? EPD_HEIGHT : area.y + area.height;
+    if (x0 >= x1 || y0 >= y1) {
+        return EPD_DRAW_SUCCESS;
+    }
+
+    waveform_pass(mode, (x1 - x0) * (y1 - y0), false);
+
+    // epdiy works on whole bytes, so does the copy
+    int first_byte = x0 / 2;
+    int end_byte = (x1 + 1) / 2;
+    for (int y = y0; y < y1; y++) {
+        int offset = y * EPD_WIDTH / 2 + first_byte;
+        memcpy(panel + offset, state->front_fb + offset, end_byte - first_byte);
+        memcpy(state->back_fb + offset, state->front_fb + offset, end_byte - first_byte);
+    }
+
+    return EPD_DRAW_SUCCESS;
+}
+
+enum EpdDrawError epd_hl_update_screen(EpdiyHighlevelState *state, enum EpdDrawMode mode, int temperature)
+{
+    return epd_hl_update_area(state, mode, temperature, epd_full_screen());
+}
+
+void epd_hl_set_all_white(EpdiyHighlevelState *state)
+{
+    memset(state->front_fb, 0xFF, FB_SIZE);
+}
@@ -0,0 +1,202 @@
+/*
+ * Display port calls against the mock panel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <defaultatoms.h>
+#include <epd_driver.h>
+
+#include "harness.h"
+#include "mock_epd.h"
+#include "raster.h"
+#include "refresh.h"
+#include "testfont.h"
+
+// Gray level (0-15) shown on the panel at x, y
+static int panel_pixel(int x, int y)
+{
+    uint8_t byte = mock_epd_panel()[y * EPD_WIDTH / 2 + x / 2];
+    return x % 2 ? byte >> 4 : byte & 0x0F;
+}
+
+static term update(TestDisplay *display, const term *items, int len)
+{
+    return test_display_call(display, test_tuple(display, 2, test_atom(display, "update"), test_list(display, items, len)));
+}
+
+static void test_update_and_stats(TestDisplay *display)
+{
+    term items[] = {
+        test_fill_rect(display, 10, 20, 100, 50, 0x000000),
+        test_rect(display, 200, 200, 40, 40, 0x000000),
+        test_text(display, 300, 300, "default16px", 0x000000, "hello")
+    };
+    CHECK(update(display, items, 3) == OK_ATOM);
+
+    CHECK(panel_pixel(10, 20) == 0);
+    CHECK(panel_pixel(109, 69) == 0);
+    CHECK(panel_pixel(110, 70) == 15);
+    CHECK(panel_pixel(200, 220) == 0);
+    CHECK(panel_pixel(220, 220) == 15);
+
+    term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+    CHECK(test_stats_get(display, stats, "updates") == 1);
+    // the fill_rect spans two raster bands, it is still counted once
+    CHECK(test_stats_get(display, stats, "commands") == 3);
+    CHECK(test_stats_get(display, stats, "pixels") == 100 * 50 + 2 * (40 + 40));
+    CHECK(test_stats_get(display, stats, "glyphs") == 5);
+}
+
+static void test_image_sizes(TestDisplay *display)
+{
+    uint8_t black[16 * 16] = { 0 };
+
+    // 65536 x 65536 x 4 wraps to 0 in 32 bits, so the short data was taken as enough
+    term items[] = {
+        test_image(display, 500, 400, "rgba8888", 65536, 65536, black, sizeof(black)),
+        test_image(display, 600, 400, "gray8", -16, 16, black, sizeof(black)),
+        test_image(display, 700, 400, "gray8", 16, 16, black, sizeof(black))
+    };
+    CHECK(update(display, items, 3) == OK_ATOM);
+
+    CHECK(panel_pixel(500, 400) == 15);
+    CHECK(panel_pixel(600, 400) == 15);
+    CHECK(panel_pixel(700, 400) == 0);
+    CHECK(panel_pixel(715, 415) == 0);
+}
+
+static void test_refresh_stats(TestDisplay *display)
+{
+    term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+    CHECK(test_stats_get(display, stats, "refresh_areas") >= 1);
+    CHECK(test_stats_get(display, stats, "refresh_clean") == 0);
+
+    // black and white changes use DU, past the ghosting budget of a tile the screen is cleaned
+    bool cleaned = false;
+    for (int i = 0; i <= REFRESH_DEFAULT_GHOSTING_BUDGET && !cleaned; i++) {
+        term items[] = { test_fill_rect(display, 900, 500, 10, 10, i % 2 ? 0xFFFFFF : 0x000000) };
+        CHECK(update(display, items, 1) == OK_ATOM);
+        stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+        cleaned = test_stats_get(display, stats, "refresh_clean") == 1;
+    }
+    CHECK(cleaned);
+}
+
+#define GRID_COLUMNS 40
+#define GRID_ROWS 25
+#define GRID_PITCH 16
+
+// A grid of 12 x 12 squares, the one at column, row is drawn with color instead of black
+static void update_grid(TestDisplay *display, int column, int row, int color)
+{
+    static term items[GRID_COLUMNS * GRID_ROWS];
+    for (int i = 0; i < GRID_COLUMNS * GRID_ROWS; i++) {
+        int x = i % GRID_COLUMNS;
+        int y = i / GRID_COLUMNS;
+        int item_color = x == column && y == row ? color : 0x000000;
+        items[i] = test_fill_rect(display, x * GRID_PITCH, y * GRID_PITCH, 12, 12, item_color);
+    }
+    CHECK(update(display, items, GRID_COLUMNS * GRID_ROWS) == OK_ATOM);
+}
+
+static void test_single_item_damage(TestDisplay *display)
+{
+    update_grid(display, -1, -1, 0);
+
+    // within the 64 x 64 tile at 64, 64
+    update_grid(display, 5, 5, 0xFFFFFF);
+    CHECK(panel_pixel(80, 80) == 15);
+    CHECK(panel_pixel(64, 80) == 0);
+
+    term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+    CHECK(test_stats_get(display, stats, "commands") == 1);
+    CHECK(test_stats_get(display, stats, "pixels") == 12 * 12);
+    CHECK(test_stats_get(display, stats, "dirty_tiles") == 1);
+    CHECK(test_stats_get(display, stats, "refresh_areas") == 1);
+}
+
+static void test_same_gray_recolor(TestDisplay *display)
+{
+    update_grid(display, -1, -1, 0);
+
+    // a new color for the list diff, but the same gray level in the framebuffer
+    CHECK(gray4(0x01, 0x01, 0x01) == gray4(0x00, 0x00, 0x00));
+    update_grid(display, 5, 5, 0x010101);
+
+    term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+    CHECK(test_stats_get(display, stats, "commands") == 1);
+    CHECK(test_stats_get(display, stats, "dirty_tiles") == 0);
+    CHECK(test_stats_get(display, stats, "refresh_areas") == 0);
+}
+
+static void test_stats_range(TestDisplay *display)
+{
+    // pixels counts the unclipped size, past the 28 bit small integers of a 32 bit device
+    term items[] = { test_fill_rect(display, 0, 0, 20000, 20000, 0xFFFFFF) };
+    CHECK(update(display, items, 1) == OK_ATOM);
+
+    term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+    CHECK(test_stats_get(display, stats, "pixels") == (1 << 27) - 1);
+}
+
+static void test_register_font(TestDisplay *display)
+{
+    for (int compressed = 0; compressed < 2; compressed++) {
+        size_t size;
+        uint8_t *font = test_font_build(compressed, &size);
+        const char *name = compressed ? "compressed" : "uncompressed";
+        CHECK(test_display_call(display, test_tuple(display, 3, test_atom(display, "register_font"),
+                  test_atom(display, name), test_binary(display, font, size)))
+            == OK_ATOM);
+        free(font);
+
+        // across the boundary between two raster bands, at y = 128
+        term items[] = { test_text(display, 400, 120, name, 0x000000, "AB") };
+        CHECK(update(display, items, 1) == OK_ATOM);
+        // the top left corner of the box outline of A
+        CHECK(panel_pixel(400, 120) == 0);
+        CHECK(panel_pixel(399, 120) == 15);
+
+        term stats = test_display_call(display, test_tuple(display, 1, test_atom(display, "stats")));
+        CHECK(test_stats_get(display, stats, "commands") == 1);
+        CHECK(test_stats_get(display, stats, "glyphs") == 2);
+        if (compressed) {
+            // decompressed once by whichever band comes first, found by the other one
+            CHECK(test_stats_get(display, stats, "glyph_cache_misses") == 2);
+            CHECK(test_stats_get(display, stats, "glyph_cache_hits") == 2);
+        }
+    }
+}
+
+int main()
+{
+    TestDisplay display;
+    test_display_init(&display);
+    CHECK(test_display_open(&display, term_nil()));
+
+    MockEpdStats epd;
+    mock_epd_get_stats(&epd);
+    CHECK(epd.clears == 1);
+    CHECK(epd.unpowered_passes == 0);
+
+    test_update_and_stats(&display);
+    test_image_sizes(&display);
+    test_refresh_stats(&display);
+    test_single_item_damage(&display);
+    test_same_gray_recolor(&display);
+    test_stats_range(&display);
+    test_register_font(&display);
+
+    mock_epd_get_stats(&epd);
+    CHECK(epd.unpowered_passes == 0);
+
+    if (getenv("DISPLAY_DUMP")) {
+        mock_epd_dump_pgm(getenv("DISPLAY_DUMP"));
+    }
+
+    printf("test_display: ok\n");
+    return 0;
+}
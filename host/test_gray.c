@@ -0,0 +1,56 @@
+/*
+ * gray4 against the float Rec. 709 conversion it replaced, over every RGB
+ * color.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "harness.h"
+#include "raster.h"
+
+// The conversion used before the fixed point luma and gray level table
+static uint8_t float_gray4(uint8_t r, uint8_t g, uint8_t b)
+{
+    float luma = 0.2126f * (float) r + 0.7152f * (float) g + 0.0722f * (float) b;
+    return (uint8_t) (luma + 0.5F) >> 4;
+}
+
+/*
+ * Colors whose exact luma is a multiple of 16 minus one half. The float
+ * sum comes out slightly below it and was rounded down, the fixed point
+ * luma rounds half up, so they land one gray level higher.
+ */
+static const uint32_t rounded_up[] = {
+    0x3075F4, 0x3D9C29, 0x4F4103, 0x603734, 0x620376, 0x6F6123, 0x7DDC69,
+    0xB339E7, 0xBFB173, 0xC1463D, 0xC22C5E, 0xC3127F, 0xD408B0, 0xF30B37
+};
+
+#define ROUNDED_UP_COUNT (sizeof(rounded_up) / sizeof(rounded_up[0]))
+
+int main()
+{
+    raster_init(1.0f);
+
+    unsigned int next = 0;
+    for (uint32_t color = 0; color < 0x1000000; color++) {
+        uint8_t r = color >> 16;
+        uint8_t g = color >> 8;
+        uint8_t b = color;
+
+        uint8_t expected = float_gray4(r, g, b);
+        if (next < ROUNDED_UP_COUNT && color == rounded_up[next]) {
+            CHECK(luma_rec709(r, g, b) % 16 == 0);
+            expected++;
+            next++;
+        }
+        if (gray4(r, g, b) != expected) {
+            fprintf(stderr, "0x%06X: gray4 %d, expected %d\n", color, gray4(r, g, b), expected);
+            return 1;
+        }
+    }
+    CHECK(next == ROUNDED_UP_COUNT);
+
+    printf("test_gray: ok\n");
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*
+ * Image and glyph drawing against a pixel by pixel reference, at the
+ * rotation given in degrees as the argument. Sources of random sizes are
+ * drawn at random positions, partly off screen, through random clip rects,
+ * over a framebuffer of random pixels so that skipped pixels are checked
+ * too. Rotated drawing goes through the tiled transpose of raster.c, the
+ * reference maps each source pixel on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <epd_driver.h>
+
+#include "harness.h"
+#include "raster.h"
+
+#define FRAMEBUFFER_SIZE (RASTER_LINE_BYTES * EPD_HEIGHT)
+#define ROUNDS 300
+#define MAX_SIZE 100
+
+// source pixel that leaves the framebuffer untouched
+#define SKIP -1
+
+static uint8_t actual[FRAMEBUFFER_SIZE];
+static uint8_t expected[FRAMEBUFFER_SIZE];
+
+static uint32_t random_state = 1;
+
+// xorshift32, so that a failure is reproduced on any host
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Uniform in [low, high]
+static int random_between(int low, int high)
+{
+    return low + (int) (next_random() % (uint32_t) (high - low + 1));
+}
+
+static void fill_random(uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        data[i] = next_random();
+    }
+}
+
+// Framebuffer position of (x, y), written out from the raster.h description
+static void rotate(int rotation, int x, int y, int *px, int *py)
+{
+    switch (rotation) {
+        case 90:
+            *px = EPD_WIDTH - 1 - y;
+            *py = x;
+            break;
+        case 180:
+            *px = EPD_WIDTH - 1 - x;
+            *py = EPD_HEIGHT - 1 - y;
+            break;
+        case 270:
+            *px = y;
+            *py = EPD_HEIGHT - 1 - x;
+            break;
+        default:
+            *px = x;
+            *py = y;
+    }
+}
+
+static int nibble(const uint8_t *data, int stride, int x, int y)
+{
+    return (data[y * stride + x / 2] >> ((x & 1) * 4)) & 0xF;
+}
+
+/*
+ * A source to draw and how the reference sees it: pixel returns the gray
+ * level of a source pixel or SKIP.
+ */
+struct Source
+{
+    const char *name;
+    int width;
+    int height;
+    const uint8_t *data;
+    const uint8_t *color_lut;
+    bool opaque;
+    uint8_t color;
+    int bgcolor;
+    int (*pixel)(const struct Source *source, int sx, int sy);
+    void (*draw)(const RasterTarget *target, int x, int y, const struct Source *source);
+};
+
+static int rgba8888_pixel(const struct Source *source, int sx, int sy)
+{
+    const uint8_t *p = source->data + (sy * source->width + sx) * 4;
+    return p[3] ? gray4(p[0], p[1], p[2]) : 0xF;
+}
+
+static void rgba8888_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    raster_blit_rgba8888(target, x, y, source->width, source->height, source->data);
+}
+
+static int gray4_pixel(const struct Source *source, int sx, int sy)
+{
+    return nibble(source->data, (source->width + 1) / 2, sx, sy);
+}
+
+static void gray4_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    raster_blit_gray4(target, x, y, source->width, source->height, source->data);
+}
+
+static int gray8_pixel(const struct Source *source, int sx, int sy)
+{
+    return raster_gray_lut[source->data[sy * source->width + sx]];
+}
+
+static void gray8_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    raster_blit_gray8(target, x, y, source->width, source->height, source->data);
+}
+
+static int glyph_pixel(const struct Source *source, int sx, int sy)
+{
+    int value = nibble(source->data, (source->width + 1) / 2, sx, sy);
+    return value || source->opaque ? source->color_lut[value] : SKIP;
+}
+
+static void glyph_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    raster_blend_glyph(target, x, y, source->width, source->height, source->data, source->color_lut,
+        source->opaque);
+}
+
+static int mono8_pixel(const struct Source *source, int sx, int sy)
+{
+    if (source->data[sy] & (0x80 >> sx)) {
+        return source->color;
+    }
+    return source->bgcolor < 0 ? SKIP : source->bgcolor;
+}
+
+static void mono8_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    raster_draw_mono8_glyph(target, x, y, source->data, source->height, source->color, source->bgcolor);
+}
+
+static void reference_draw(const RasterTarget *target, int x, int y, const struct Source *source)
+{
+    EpdRect clip = target->clip;
+    for (int sy = 0; sy < source->height; sy++) {
+        for (int sx = 0; sx < source->width; sx++) {
+            int px, py;
+            rotate(target->rotation, x + sx, y + sy, &px, &py);
+            if (px < clip.x || px >= clip.x + clip.width || py < clip.y || py >= clip.y + clip.height) {
+                continue;
+            }
+            int gray = source->pixel(source, sx, sy);
+            if (gray == SKIP) {
+                continue;
+            }
+            uint8_t *dst = expected + py * RASTER_LINE_BYTES + px / 2;
+            *dst = px & 1 ? (*dst & 0x0F) | (gray << 4) : (*dst & 0xF0) | gray;
+        }
+    }
+}
+
+static void check_framebuffer(const struct Source *source, int rotation, int x, int y, EpdRect clip)
+{
+    if (memcmp(actual, expected, FRAMEBUFFER_SIZE) == 0) {
+        return;
+    }
+
+    for (int i = 0; i < FRAMEBUFFER_SIZE; i++) {
+        if (actual[i] != expected[i]) {
+            fprintf(stderr,
+                "%s %dx%d at %d,%d rotated %d, clip %d,%d %dx%d: byte %d,%d is 0x%02X instead of 0x%02X\n",
+                source->name, source->width, source->height, x, y, rotation, clip.x, clip.y, clip.width,
+                clip.height, i % RASTER_LINE_BYTES * 2, i / RASTER_LINE_BYTES, actual[i], expected[i]);
+            break;
+        }
+    }
+    exit(1);
+}
+
+// Draw source in a random spot through a random clip rect, with both the raster functions and the reference
+static void draw_random(const struct Source *source, int rotation)
+{
+    bool swapped = rotation == 90 || rotation == 270;
+    int screen_width = swapped ? EPD_HEIGHT : EPD_WIDTH;
+    int screen_height = swapped ? EPD_WIDTH : EPD_HEIGHT;
+
+    // up to half of the source off screen on any side
+    int x = random_between(-source->width / 2, screen_width - (source->width + 1) / 2);
+    int y = random_between(-source->height / 2, screen_height - (source->height + 1) / 2);
+
+    // a clip rect around the drawn area, in framebuffer coordinates
+    EpdRect logical = { .x = x, .y = y, .width = source->width, .height = source->height };
+    EpdRect area = raster_rotate_rect(rotation, logical);
+    EpdRect clip;
+    clip.x = random_between(area.x - 8, area.x + area.width - 1);
+    clip.y = random_between(area.y - 8, area.y + area.height - 1);
+    clip.width = random_between(1, area.width + 16);
+    clip.height = random_between(1, area.height + 16);
+    if (clip.x < 0) {
+        clip.width += clip.x;
+        clip.x = 0;
+    }
+    if (clip.y < 0) {
+        clip.height += clip.y;
+        clip.y = 0;
+    }
+    if (clip.x + clip.width > EPD_WIDTH) {
+        clip.width = EPD_WIDTH - clip.x;
+    }
+    if (clip.y + clip.height > EPD_HEIGHT) {
+        clip.height = EPD_HEIGHT - clip.y;
+    }
+    if (clip.width <= 0 || clip.height <= 0) {
+        clip.x = clip.y = clip.width = clip.height = 0;
+    }
+
+    RasterTarget target;
+    raster_target_init(&target, actual);
+    target.clip = clip;
+    target.rotation = rotation;
+    source->draw(&target, x, y, source);
+
+    target.framebuffer = expected;
+    reference_draw(&target, x, y, source);
+
+    check_framebuffer(source, rotation, x, y, clip);
+}
+
+int main(int argc, char **argv)
+{
+    int rotation = argc > 1 ? atoi(argv[1]) : 0;
+
+    raster_init(1.0f);
+    fill_random(actual, FRAMEBUFFER_SIZE);
+    memcpy(expected, actual, FRAMEBUFFER_SIZE);
+
+    static uint8_t data[MAX_SIZE * MAX_SIZE * 4];
+    uint8_t color_lut[16];
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int width = random_between(1, MAX_SIZE);
+        int height = random_between(1, MAX_SIZE);
+        fill_random(data, sizeof(data));
+
+        // about one pixel in four fully transparent
+        for (int i = 0; i < width * height; i++) {
+            if ((data[i * 4] & 3) == 0) {
+                data[i * 4 + 3] = 0;
+            }
+        }
+        struct Source image = { .width = width, .height = height, .data = data };
+
+        image.name = "rgba8888";
+        image.pixel = rgba8888_pixel;
+        image.draw = rgba8888_draw;
+        draw_random(&image, rotation);
+
+        image.name = "gray4";
+        image.pixel = gray4_pixel;
+        image.draw = gray4_draw;
+        draw_random(&image, rotation);
+
+        image.name = "gray8";
+        image.pixel = gray8_pixel;
+        image.draw = gray8_draw;
+        draw_random(&image, rotation);
+
+        for (int i = 0; i < 16; i++) {
+            color_lut[i] = next_random() & 0xF;
+        }
+        struct Source glyph = {
+            .width = width % 40 + 1,
+            .height = height % 40 + 1,
+            .data = data,
+            .color_lut = color_lut,
+            .pixel = glyph_pixel,
+            .draw = glyph_draw
+        };
+
+        glyph.name = "transparent glyph";
+        glyph.opaque = false;
+        draw_random(&glyph, rotation);
+
+        glyph.name = "opaque glyph";
+        glyph.opaque = true;
+        draw_random(&glyph, rotation);
+
+        struct Source mono8 = {
+            .width = 8,
+            .height = height % 24 + 1,
+            .data = data,
+            .color = next_random() & 0xF,
+            .pixel = mono8_pixel,
+            .draw = mono8_draw
+        };
+
+        mono8.name = "transparent mono8 glyph";
+        mono8.bgcolor = -1;
+        draw_random(&mono8, rotation);
+
+        mono8.name = "opaque mono8 glyph";
+        mono8.bgcolor = next_random() & 0xF;
+        draw_random(&mono8, rotation);
+    }
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Refreshes run on the refresh worker: while the mock panel holds a
+ * waveform, the port keeps answering calls, and update and flush callers
+ * are only answered once the waveform is released and their frame is on
+ * the panel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <defaultatoms.h>
+#include <epd_driver.h>
+
+#include "harness.h"
+#include "mock_epd.h"
+
+#define WAVEFORM_DELAY_MS 100
+// how long a reply that must not come yet is waited for
+#define OUTSTANDING_MS 50
+
+static int panel_pixel(int x, int y)
+{
+    uint8_t byte = mock_epd_panel()[y * EPD_WIDTH / 2 + x / 2];
+    return x % 2 ? byte >> 4 : byte & 0x0F;
+}
+
+static term list1(TestDisplay *display, term item)
+{
+    return test_list(display, &item, 1);
+}
+
+int main()
+{
+    TestDisplay display;
+    test_display_init(&display);
+    CHECK(test_display_open(&display, term_nil()));
+    mock_epd_set_waveform_delay_us(WAVEFORM_DELAY_MS * 1000);
+
+    term update = test_atom(&display, "update");
+    term draw = test_atom(&display, "draw");
+    term flush = test_atom(&display, "flush");
+
+    // the draw call is answered while the update is held on its way to the panel
+    mock_epd_hold_waveforms(true);
+    uint64_t update_ref = test_display_send(&display,
+        test_tuple(&display, 2, update, list1(&display, test_fill_rect(&display, 0, 0, 100, 100, 0))));
+    CHECK(test_display_call(&display,
+              test_tuple(&display, 2, draw, list1(&display, test_fill_rect(&display, 200, 0, 100, 100, 0))))
+        == OK_ATOM);
+    CHECK(test_display_wait(&display, update_ref, OUTSTANDING_MS) == 0);
+    CHECK(panel_pixel(0, 0) == 15);
+
+    mock_epd_hold_waveforms(false);
+    CHECK(test_display_wait(&display, update_ref, 10000) == OK_ATOM);
+    CHECK(panel_pixel(0, 0) == 0);
+    // drawn, not flushed yet
+    CHECK(panel_pixel(200, 0) == 15);
+
+    term stats = test_display_call(&display, test_tuple(&display, 1, test_atom(&display, "stats")));
+    CHECK(test_stats_get(&display, stats, "refresh_us") >= WAVEFORM_DELAY_MS * 1000);
+
+    // flush is answered once the panel is refreshed
+    mock_epd_hold_waveforms(true);
+    uint64_t flush_ref = test_display_send(&display, test_tuple(&display, 1, flush));
+    CHECK(test_display_wait(&display, flush_ref, OUTSTANDING_MS) == 0);
+    CHECK(panel_pixel(200, 0) == 15);
+
+    mock_epd_hold_waveforms(false);
+    CHECK(test_display_wait(&display, flush_ref, 10000) == OK_ATOM);
+    CHECK(panel_pixel(200, 0) == 0);
+
+    // updates queued behind a running refresh are answered by the next one
+    mock_epd_hold_waveforms(true);
+    uint64_t first = test_display_send(&display,
+        test_tuple(&display, 2, update, list1(&display, test_fill_rect(&display, 0, 200, 100, 100, 0))));
+    uint64_t second = test_display_post(&display,
+        test_tuple(&display, 2, update, list1(&display, test_fill_rect(&display, 200, 200, 100, 100, 0))));
+    uint64_t third = test_display_post(&display,
+        test_tuple(&display, 2, update, list1(&display, test_fill_rect(&display, 400, 200, 100, 100, 0))));
+    test_display_run(&display);
+    CHECK(test_display_wait(&display, first, OUTSTANDING_MS) == 0);
+
+    mock_epd_hold_waveforms(false);
+    CHECK(test_display_wait(&display, first, 10000) == OK_ATOM);
+    CHECK(test_display_wait(&display, second, 10000) == OK_ATOM);
+    CHECK(test_display_wait(&display, third, 10000) == OK_ATOM);
+
+    // the second display list was superseded by the third before being drawn
+    CHECK(panel_pixel(200, 200) == 15);
+    CHECK(panel_pixel(400, 200) == 0);
+
+    MockEpdStats after;
+    mock_epd_get_stats(&after);
+    CHECK(after.unpowered_passes == 0);
+
+    printf("test_refresh: ok\n");
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Display lists drawn with a rotation, given in degrees as the argument:
+ * removing an item clears it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <defaultatoms.h>
+#include <epd_driver.h>
+
+#include "harness.h"
+#include "mock_epd.h"
+
+static int black_pixels()
+{
+    int count = 0;
+    const uint8_t *panel = mock_epd_panel();
+    for (int i = 0; i < EPD_WIDTH / 2 * EPD_HEIGHT; i++) {
+        count += (panel[i] & 0x0F) == 0;
+        count += (panel[i] >> 4) == 0;
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    int rotation = argc > 1 ? atoi(argv[1]) : 0;
+
+    TestDisplay display;
+    test_display_init(&display);
+    term opts[] = { test_tuple(&display, 2, test_atom(&display, "rotation"), term_from_int(rotation)) };
+    CHECK(test_display_open(&display, test_list(&display, opts, 1)));
+
+    term update = test_atom(&display, "update");
+
+    // a band boundary goes through the rect whatever the rotation
+    term items[] = {
+        test_fill_rect(&display, 10, 40, 100, 100, 0x000000),
+        test_fill_rect(&display, 300, 200, 20, 30, 0x000000)
+    };
+    CHECK(test_display_call(&display, test_tuple(&display, 2, update, test_list(&display, items, 2))) == OK_ATOM);
+    CHECK(black_pixels() == 100 * 100 + 20 * 30);
+
+    CHECK(test_display_call(&display, test_tuple(&display, 2, update, test_list(&display, items + 1, 1))) == OK_ATOM);
+    CHECK(black_pixels() == 20 * 30);
+
+    CHECK(test_display_call(&display, test_tuple(&display, 2, update, term_nil())) == OK_ATOM);
+    CHECK(black_pixels() == 0);
+
+    printf("test_rotation %d: ok\n", rotation);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "testfont.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#define FIRST_CODEPOINT 32
+#define LAST_CODEPOINT 126
+#define GLYPHS_COUNT (LAST_CODEPOINT - FIRST_CODEPOINT + 1)
+#define GLYPH_WIDTH 10
+#define GLYPH_HEIGHT 16
+#define GLYPH_BYTES (GLYPH_WIDTH / 2 * GLYPH_HEIGHT)
+
+struct Buffer
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+static void put(struct Buffer *buf, const void *data, size_t size)
+{
+    if (buf->size + size > buf->capacity) {
+        buf->capacity = (buf->size + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+        if (!buf->data) {
+            abort();
+        }
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+}
+
+static void put_le(struct Buffer *buf, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        uint8_t byte = value >> (8 * i);
+        put(buf, &byte, 1);
+    }
+}
+
+static void put_be32(struct Buffer *buf, uint32_t value)
+{
+    uint8_t bytes[4] = { value >> 24, value >> 16, value >> 8, value };
+    put(buf, bytes, 4);
+}
+
+// An IFF record, padded to 4 bytes
+static void put_record(struct Buffer *buf, const char *name, const struct Buffer *record)
+{
+    put(buf, name, 4);
+    put_be32(buf, record->size);
+    put(buf, record->data, record->size);
+    static const uint8_t padding[3];
+    put(buf, padding, (4 - record->size % 4) % 4);
+}
+
+// A box outline with a pattern depending on the codepoint inside, space is empty
+static void glyph_bitmap(int codepoint, uint8_t *bitmap)
+{
+    memset(bitmap, 0, GLYPH_BYTES);
+    if (codepoint == ' ') {
+        return;
+    }
+    for (int y = 0; y < GLYPH_HEIGHT; y++) {
+        for (int x = 0; x < GLYPH_WIDTH; x++) {
+            bool edge = x == 0 || y == 0 || x == GLYPH_WIDTH - 1 || y == GLYPH_HEIGHT - 1;
+            bool inside = ((x * 7 + y * 3 + codepoint) % 5) == 0;
+            uint8_t alpha = edge ? 0xF : inside ? 0x8 : 0x0;
+            bitmap[y * GLYPH_WIDTH / 2 + x / 2] |= x % 2 ? alpha << 4 : alpha;
+        }
+    }
+}
+
+uint8_t *test_font_build(bool compressed, size_t *size)
+{
+    struct Buffer header = { 0 };
+    put_le(&header, 1, 4); // intervals
+    put_le(&header, compressed, 1);
+    put_le(&header, 20, 2); // advance_y
+    put_le(&header, 16, 2); // ascender
+    put_le(&header, 4, 2); // descender
+
+    struct Buffer glyphs = { 0 };
+    struct Buffer bitmaps = { 0 };
+    for (int codepoint = FIRST_CODEPOINT; codepoint <= LAST_CODEPOINT; codepoint++) {
+        uint8_t bitmap[GLYPH_BYTES];
+        glyph_bitmap(codepoint, bitmap);
+
+        uint32_t offset = bitmaps.size;
+        uint32_t data_size = GLYPH_BYTES;
+        if (compressed) {
+            uint8_t deflated[GLYPH_BYTES + 64];
+            uLongf deflated_size = sizeof(deflated);
+            if (compress(deflated, &deflated_size, bitmap, GLYPH_BYTES) != Z_OK) {
+                abort();
+            }
+            put(&bitmaps, deflated, deflated_size);
+            data_size = deflated_size;
+        } else {
+            put(&bitmaps, bitmap, GLYPH_BYTES);
+        }
+
+        put_le(&glyphs, GLYPH_WIDTH, 2);
+        put_le(&glyphs, GLYPH_HEIGHT, 2);
+        put_le(&glyphs, GLYPH_WIDTH + 1, 2); // advance_x
+        put_le(&glyphs, 0, 2); // left
+        put_le(&glyphs, 16, 2); // top
+        put_le(&glyphs, data_size, 4);
+        put_le(&glyphs, offset, 4);
+    }
+
+    struct Buffer intervals = { 0 };
+    put_le(&intervals, FIRST_CODEPOINT, 4);
+    put_le(&intervals, LAST_CODEPOINT, 4);
+    put_le(&intervals, 0, 4);
+
+    struct Buffer body = { 0 };
+    put(&body, "UFL0", 4);
+    put_record(&body, "uFH0", &header);
+    put_record(&body, "uFP0", &glyphs);
+    put_record(&body, "uFI0", &intervals);
+    put_record(&body, "uFB0", &bitmaps);
+
+    struct Buffer font = { 0 };
+    put(&font, "FORM", 4);
+    put_be32(&font, body.size + 8);
+    put(&font, body.data, body.size);
+
+    free(header.data);
+    free(glyphs.data);
+    free(bitmaps.data);
+    free(intervals.data);
+    free(body.data);
+
+    *size = font.size;
+    return font.data;
+}
@@ -0,0 +1,19 @@
+/*
+ * Host build: a generated font in the ufontlib UFL format, covering the
+ * printable ASCII range with 10x16 glyphs.
+ */
+
+#ifndef _TESTFONT_H_
+#define _TESTFONT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Build the font, with zlib compressed glyphs or not. The returned buffer
+ * is allocated with malloc, size is set to its length.
+ */
+uint8_t *test_font_build(bool compressed, size_t *size);
+
+#endif
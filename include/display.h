@@ -2,8 +2,10 @@
 #define _DISPLAY_H_
 
 #include <context.h>
+#include <globalcontext.h>
 #include <term.h>
 
-void display_port_driver_init(Context *ctx, term opts);
+void display_init(GlobalContext *global);
+Context *display_create_port(GlobalContext *global, term opts);
 
 #endif
@@ -0,0 +1,60 @@
+#include "power.h"
+
+#include <epd_driver.h>
+#include <esp_timer.h>
+
+void panel_power_init(PanelPower *power)
+{
+    power->on = false;
+    power->idle_timeout_ms = POWER_DEFAULT_IDLE_TIMEOUT_MS;
+    power->temperature_ttl_ms = POWER_DEFAULT_TEMPERATURE_TTL_MS;
+    power->temperature = 0;
+    power->temperature_time_us = -1;
+    power->on_since_us = 0;
+    power->power_ons = 0;
+    power->powered_us = 0;
+}
+
+void panel_power_on(PanelPower *power)
+{
+    if (power->on) {
+        return;
+    }
+
+    epd_poweron();
+    power->on = true;
+    power->on_since_us = esp_timer_get_time();
+    power->power_ons++;
+}
+
+void panel_power_off(PanelPower *power)
+{
+    if (!power->on) {
+        return;
+    }
+
+    epd_poweroff();
+    power->on = false;
+    power->powered_us += esp_timer_get_time() - power->on_since_us;
+}
+
+int panel_power_temperature(PanelPower *power)
+{
+    int64_t now = esp_timer_get_time();
+    if (power->temperature_time_us < 0
+        || now - power->temperature_time_us >= (int64_t) power->temperature_ttl_ms * 1000) {
+        power->temperature = epd_ambient_temperature();
+        power->temperature_time_us = now;
+    }
+
+    return power->temperature;
+}
+
+uint64_t panel_power_powered_us(const PanelPower *power)
+{
+    if (!power->on) {
+        return power->powered_us;
+    }
+
+    return power->powered_us + (esp_timer_get_time() - power->on_since_us);
+}
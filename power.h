@@ -0,0 +1,57 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define POWER_DEFAULT_IDLE_TIMEOUT_MS 1000
+#define POWER_DEFAULT_TEMPERATURE_TTL_MS 60000
+
+/**
+ * Panel power rails and ambient temperature.
+ *
+ * Turning the rails on and off takes a noticeable part of a refresh, so the
+ * panel is kept powered between refreshes and only turned off once nothing
+ * has been refreshed for idle_timeout_ms. The temperature changes slowly and
+ * is read again only when the last reading is older than temperature_ttl_ms.
+ *
+ * Not thread safe: only the task driving the panel may use it.
+ */
+typedef struct
+{
+    bool on;
+    uint32_t idle_timeout_ms;
+    uint32_t temperature_ttl_ms;
+    int temperature;
+    int64_t temperature_time_us;
+    int64_t on_since_us;
+
+    // number of times the rails were turned on and total time they were on
+    uint32_t power_ons;
+    uint64_t powered_us;
+} PanelPower;
+
+void panel_power_init(PanelPower *power);
+
+/**
+ * Turn the rails on if they are off.
+ */
+void panel_power_on(PanelPower *power);
+
+/**
+ * Turn the rails off if they are on.
+ */
+void panel_power_off(PanelPower *power);
+
+/**
+ * Ambient temperature in degrees Celsius, read again if the last reading
+ * expired.
+ */
+int panel_power_temperature(PanelPower *power);
+
+/**
+ * Total time the rails were on, including the current period.
+ */
+uint64_t panel_power_powered_us(const PanelPower *power);
+
+#endif
@@ -0,0 +1,667 @@
+#include "raster.h"
+
+#include <math.h>
+#include <string.h>
+
+static inline int min(int x, int y) { return x < y ? x : y; }
+static inline int max(int x, int y) { return x > y ? x : y; }
+
+// Clip the given area against the target clip rect, returns 0 when nothing is left.
+static int clip_area(const RasterTarget *target, int x, int y, int width, int height,
+    int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = max(x, target->clip.x);
+    *y0 = max(y, target->clip.y);
+    *x1 = min(x + width, target->clip.x + target->clip.width);
+    *y1 = min(y + height, target->clip.y + target->clip.height);
+
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+uint8_t raster_gray_lut[256];
+
+// 1bpp byte to a nibble mask of 8 packed pixels, leftmost pixel in the lowest nibble
+static uint32_t mono8_expand[256];
+
+void raster_init(float gamma)
+{
+    for (int i = 0; i < 256; i++) {
+        int level = i;
+        if (gamma != 1.0f) {
+            level = (int) (255.0f * powf(i / 255.0f, gamma) + 0.5f);
+        }
+        raster_gray_lut[i] = level >> 4;
+
+        uint32_t mask = 0;
+        for (int k = 0; k < 8; k++) {
+            if (i & (0x80 >> k)) {
+                mask |= 0xFu << (k * 4);
+            }
+        }
+        mono8_expand[i] = mask;
+    }
+}
+
+void raster_target_init(RasterTarget *target, uint8_t *framebuffer)
+{
+    target->framebuffer = framebuffer;
+    target->clip.x = 0;
+    target->clip.y = 0;
+    target->clip.width = EPD_WIDTH;
+    target->clip.height = EPD_HEIGHT;
+    target->rotation = 0;
+}
+
+EpdRect raster_rotate_rect(int rotation, EpdRect rect)
+{
+    EpdRect r = rect;
+    switch (rotation) {
+        case 90:
+            r.x = EPD_WIDTH - rect.y - rect.height;
+            r.y = rect.x;
+            r.width = rect.height;
+            r.height = rect.width;
+            break;
+        case 180:
+            r.x = EPD_WIDTH - rect.x - rect.width;
+            r.y = EPD_HEIGHT - rect.y - rect.height;
+            break;
+        case 270:
+            r.x = rect.y;
+            r.y = EPD_HEIGHT - rect.x - rect.width;
+            r.width = rect.height;
+            r.height = rect.width;
+            break;
+    }
+    return r;
+}
+
+// Framebuffer position of the rotated point (x, y)
+static inline void rotate_point(int rotation, int x, int y, int *px, int *py)
+{
+    switch (rotation) {
+        case 90:
+            *px = EPD_WIDTH - 1 - y;
+            *py = x;
+            break;
+        case 180:
+            *px = EPD_WIDTH - 1 - x;
+            *py = EPD_HEIGHT - 1 - y;
+            break;
+        case 270:
+            *px = y;
+            *py = EPD_HEIGHT - 1 - x;
+            break;
+        default:
+            *px = x;
+            *py = y;
+    }
+}
+
+// Inverse of rotate_point
+static inline void unrotate_point(int rotation, int px, int py, int *x, int *y)
+{
+    switch (rotation) {
+        case 90:
+            *x = py;
+            *y = EPD_WIDTH - 1 - px;
+            break;
+        case 180:
+            *x = EPD_WIDTH - 1 - px;
+            *y = EPD_HEIGHT - 1 - py;
+            break;
+        case 270:
+            *x = EPD_HEIGHT - 1 - py;
+            *y = px;
+            break;
+        default:
+            *x = px;
+            *y = py;
+    }
+}
+
+#define ROTATED_TILE_SIZE 32
+// gray level of a source pixel that leaves the framebuffer untouched
+#define ROTATED_SKIP 0xFF
+
+typedef struct RotatedSource RotatedSource;
+
+/*
+ * Pixels of a rotated blit. fetch converts count pixels of row sy, from
+ * column sx, to gray levels or ROTATED_SKIP.
+ */
+struct RotatedSource
+{
+    const uint8_t *data;
+    int width;
+    const uint8_t *color_lut;
+    bool opaque;
+    uint8_t color;
+    int bgcolor;
+    void (*fetch)(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray);
+};
+
+static inline void put_nibble(uint8_t *line, int x, uint8_t gray)
+{
+    if (gray == ROTATED_SKIP) {
+        return;
+    }
+    uint8_t *dst = line + (x >> 1);
+    if (x & 1) {
+        *dst = (*dst & 0x0F) | (gray << 4);
+    } else {
+        *dst = (*dst & 0xF0) | gray;
+    }
+}
+
+static void write_tile(const RasterTarget *target, int x, int y, int width, int height,
+    uint8_t tile[ROTATED_TILE_SIZE][ROTATED_TILE_SIZE])
+{
+    for (int row = 0; row < height; row++) {
+        uint8_t *line = target->framebuffer + (y + row) * RASTER_LINE_BYTES;
+        const uint8_t *t = tile[row];
+        int i = 0;
+
+        if (x & 1) {
+            put_nibble(line, x, t[0]);
+            i++;
+        }
+        for (; i + 2 <= width; i += 2) {
+            if (t[i] != ROTATED_SKIP && t[i + 1] != ROTATED_SKIP) {
+                line[(x + i) >> 1] = t[i] | (t[i + 1] << 4);
+            } else {
+                put_nibble(line, x + i, t[i]);
+                put_nibble(line, x + i + 1, t[i + 1]);
+            }
+        }
+        if (i < width) {
+            put_nibble(line, x + i, t[i]);
+        }
+    }
+}
+
+/*
+ * Draw a width x height source at (x, y) on a rotated target. The clipped
+ * framebuffer area is filled one tile at a time: the source rows under the
+ * tile are converted to gray levels and transposed into the tile, which is
+ * then written out a framebuffer row at a time.
+ */
+static void blit_rotated(const RasterTarget *target, int x, int y, int width, int height,
+    const RotatedSource *source)
+{
+    EpdRect logical = {
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height
+    };
+    EpdRect area = raster_rotate_rect(target->rotation, logical);
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, area.x, area.y, area.width, area.height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    // tile offset of the next source pixel of a row
+    int step;
+    switch (target->rotation) {
+        case 90:
+            step = ROTATED_TILE_SIZE;
+            break;
+        case 180:
+            step = -1;
+            break;
+        default:
+            step = -ROTATED_TILE_SIZE;
+    }
+
+    uint8_t tile[ROTATED_TILE_SIZE][ROTATED_TILE_SIZE];
+    uint8_t gray[ROTATED_TILE_SIZE];
+
+    for (int ty = y0; ty < y1; ty += ROTATED_TILE_SIZE) {
+        int th = min(ROTATED_TILE_SIZE, y1 - ty);
+        for (int tx = x0; tx < x1; tx += ROTATED_TILE_SIZE) {
+            int tw = min(ROTATED_TILE_SIZE, x1 - tx);
+
+            // source pixels under the tile, from two opposite corners
+            int ax, ay, bx, by;
+            unrotate_point(target->rotation, tx, ty, &ax, &ay);
+            unrotate_point(target->rotation, tx + tw - 1, ty + th - 1, &bx, &by);
+            int sx0 = min(ax, bx) - x;
+            int sx1 = max(ax, bx) - x + 1;
+            int sy0 = min(ay, by) - y;
+            int sy1 = max(ay, by) - y + 1;
+
+            for (int sy = sy0; sy < sy1; sy++) {
+                source->fetch(source, sx0, sy, sx1 - sx0, gray);
+
+                int px, py;
+                rotate_point(target->rotation, x + sx0, y + sy, &px, &py);
+                uint8_t *dst = &tile[py - ty][px - tx];
+                for (int i = 0; i < sx1 - sx0; i++) {
+                    *dst = gray[i];
+                    dst += step;
+                }
+            }
+
+            write_tile(target, tx, ty, tw, th, tile);
+        }
+    }
+}
+
+static inline uint8_t rgba_to_gray4(const uint8_t *pixel)
+{
+    if (pixel[3]) {
+        return gray4(pixel[0], pixel[1], pixel[2]);
+    }
+    return 0xF;
+}
+
+static inline uint8_t rgba_pair_to_byte(const uint8_t *pixels)
+{
+    return rgba_to_gray4(pixels) | (rgba_to_gray4(pixels + 4) << 4);
+}
+
+static void fetch_rgba8888(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray)
+{
+    const uint8_t *src = source->data + (sy * source->width + sx) * 4;
+    for (int i = 0; i < count; i++) {
+        gray[i] = rgba_to_gray4(src + i * 4);
+    }
+}
+
+static void fetch_gray4(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray)
+{
+    const uint8_t *src = source->data + sy * ((source->width + 1) / 2);
+    for (int i = sx; i < sx + count; i++) {
+        *gray++ = (src[i / 2] >> ((i & 1) * 4)) & 0xF;
+    }
+}
+
+static void fetch_gray8(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray)
+{
+    const uint8_t *src = source->data + sy * source->width + sx;
+    for (int i = 0; i < count; i++) {
+        gray[i] = raster_gray_lut[src[i]];
+    }
+}
+
+static void fetch_mono8(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray)
+{
+    uint8_t bits = source->data[sy];
+    uint8_t bg = source->bgcolor < 0 ? ROTATED_SKIP : source->bgcolor;
+    for (int i = 0; i < count; i++) {
+        gray[i] = bits & (0x80 >> (sx + i)) ? source->color : bg;
+    }
+}
+
+static void fetch_glyph(const RotatedSource *source, int sx, int sy, int count, uint8_t *gray)
+{
+    const uint8_t *src = source->data + sy * ((source->width + 1) / 2);
+    for (int i = sx; i < sx + count; i++) {
+        uint8_t value = (src[i / 2] >> ((i & 1) * 4)) & 0xF;
+        *gray++ = value || source->opaque ? source->color_lut[value] : ROTATED_SKIP;
+    }
+}
+
+void raster_blit_rgba8888(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data)
+{
+    if (target->rotation) {
+        RotatedSource source = { .data = data, .width = width, .fetch = fetch_rgba8888 };
+        blit_rotated(target, x, y, width, height, &source);
+        return;
+    }
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, x, y, width, height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = data + ((row - y) * width + (x0 - x)) * 4;
+        uint8_t *dst = target->framebuffer + row * RASTER_LINE_BYTES + x0 / 2;
+        int px = x0;
+
+        if (px & 1) {
+            *dst = (*dst & 0x0F) | (rgba_to_gray4(src) << 4);
+            dst++;
+            src += 4;
+            px++;
+        }
+
+        // eight pixels per iteration, four whole bytes
+        while (px + 8 <= x1) {
+            dst[0] = rgba_pair_to_byte(src);
+            dst[1] = rgba_pair_to_byte(src + 8);
+            dst[2] = rgba_pair_to_byte(src + 16);
+            dst[3] = rgba_pair_to_byte(src + 24);
+            dst += 4;
+            src += 32;
+            px += 8;
+        }
+        while (px + 2 <= x1) {
+            *dst++ = rgba_pair_to_byte(src);
+            src += 8;
+            px += 2;
+        }
+
+        if (px < x1) {
+            *dst = (*dst & 0xF0) | rgba_to_gray4(src);
+        }
+    }
+}
+
+void raster_blit_gray4(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data)
+{
+    if (target->rotation) {
+        RotatedSource source = { .data = data, .width = width, .fetch = fetch_gray4 };
+        blit_rotated(target, x, y, width, height, &source);
+        return;
+    }
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, x, y, width, height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    int stride = (width + 1) / 2;
+
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = data + (row - y) * stride;
+        uint8_t *dst = target->framebuffer + row * RASTER_LINE_BYTES + x0 / 2;
+        int px = x0;
+        int sx = x0 - x;
+
+        if (px & 1) {
+            uint8_t nibble = (src[sx / 2] >> ((sx & 1) * 4)) & 0xF;
+            *dst = (*dst & 0x0F) | (nibble << 4);
+            dst++;
+            px++;
+            sx++;
+        }
+
+        int pairs = (x1 - px) / 2;
+        if ((sx & 1) == 0) {
+            // same nibble order as the framebuffer, copy whole bytes
+            memcpy(dst, src + sx / 2, pairs);
+        } else {
+            const uint8_t *s = src + sx / 2;
+            for (int i = 0; i < pairs; i++) {
+                dst[i] = (s[i] >> 4) | (s[i + 1] << 4);
+            }
+        }
+        dst += pairs;
+        px += pairs * 2;
+        sx += pairs * 2;
+
+        if (px < x1) {
+            uint8_t nibble = (src[sx / 2] >> ((sx & 1) * 4)) & 0xF;
+            *dst = (*dst & 0xF0) | nibble;
+        }
+    }
+}
+
+void raster_blit_gray8(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data)
+{
+    if (target->rotation) {
+        RotatedSource source = { .data = data, .width = width, .fetch = fetch_gray8 };
+        blit_rotated(target, x, y, width, height, &source);
+        return;
+    }
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, x, y, width, height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = data + (row - y) * width + (x0 - x);
+        uint8_t *dst = target->framebuffer + row * RASTER_LINE_BYTES + x0 / 2;
+        int px = x0;
+
+        if (px & 1) {
+            *dst = (*dst & 0x0F) | (raster_gray_lut[*src] << 4);
+            dst++;
+            src++;
+            px++;
+        }
+
+        while (px + 2 <= x1) {
+            *dst++ = raster_gray_lut[src[0]] | (raster_gray_lut[src[1]] << 4);
+            src += 2;
+            px += 2;
+        }
+
+        if (px < x1) {
+            *dst = (*dst & 0xF0) | raster_gray_lut[*src];
+        }
+    }
+}
+
+void raster_draw_mono8_glyph(const RasterTarget *target, int x, int y, const uint8_t *rows, int height,
+    uint8_t color, int bgcolor)
+{
+    if (target->rotation) {
+        RotatedSource source = {
+            .data = rows,
+            .width = 8,
+            .color = color & 0xF,
+            .bgcolor = bgcolor < 0 ? -1 : (bgcolor & 0xF),
+            .fetch = fetch_mono8
+        };
+        blit_rotated(target, x, y, 8, height, &source);
+        return;
+    }
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, x, y, 8, height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    // nibbles of the glyph cell that are inside the clip rect
+    uint64_t visible = 0xFFFFFFFFu;
+    visible &= 0xFFFFFFFFu << ((x0 - x) * 4);
+    visible &= 0xFFFFFFFFu >> ((x + 8 - x1) * 4);
+
+    // the cell covers 4 bytes when x is even and 5 when odd
+    int shift = (x & 1) * 4;
+    int first_byte = x >> 1;
+    int bytes = 4 + (x & 1);
+    visible <<= shift;
+
+    uint64_t fg = 0x1111111111111111u * (color & 0xF);
+    uint64_t bg = 0x1111111111111111u * (bgcolor & 0xF);
+
+    for (int row = y0; row < y1; row++) {
+        uint64_t mask = (uint64_t) mono8_expand[rows[row - y]] << shift;
+        uint64_t value;
+        uint64_t region;
+        if (bgcolor < 0) {
+            value = fg;
+            region = mask & visible;
+        } else {
+            value = (fg & mask) | (bg & ~mask);
+            region = visible;
+        }
+        if (!region) {
+            continue;
+        }
+
+        uint8_t *line = target->framebuffer + row * RASTER_LINE_BYTES;
+        for (int b = 0; b < bytes; b++) {
+            uint8_t m = region >> (b * 8);
+            uint8_t v = value >> (b * 8);
+            if (m == 0xFF) {
+                line[first_byte + b] = v;
+            } else if (m) {
+                line[first_byte + b] = (line[first_byte + b] & ~m) | (v & m);
+            }
+        }
+    }
+}
+
+void raster_draw_pixel(const RasterTarget *target, int x, int y, uint8_t gray)
+{
+    rotate_point(target->rotation, x, y, &x, &y);
+
+    if (x < target->clip.x || x >= target->clip.x + target->clip.width
+        || y < target->clip.y || y >= target->clip.y + target->clip.height) {
+        return;
+    }
+
+    uint8_t *dst = target->framebuffer + y * RASTER_LINE_BYTES + x / 2;
+    if (x & 1) {
+        *dst = (*dst & 0x0F) | (gray << 4);
+    } else {
+        *dst = (*dst & 0xF0) | gray;
+    }
+}
+
+void raster_fill_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t gray)
+{
+    EpdRect rect = {
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height
+    };
+    rect = raster_rotate_rect(target->rotation, rect);
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, rect.x, rect.y, rect.width, rect.height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    uint8_t packed = gray | (gray << 4);
+
+    // whole bytes in [first_byte, end_byte), an odd x0 or x1 leaves a nibble at each edge
+    int first_byte = (x0 + 1) >> 1;
+    int end_byte = x1 >> 1;
+
+    for (int row = y0; row < y1; row++) {
+        uint8_t *line = target->framebuffer + row * RASTER_LINE_BYTES;
+        if (x0 & 1) {
+            line[x0 >> 1] = (line[x0 >> 1] & 0x0F) | (gray << 4);
+        }
+        if (end_byte > first_byte) {
+            memset(line + first_byte, packed, end_byte - first_byte);
+        }
+        if (x1 & 1) {
+            line[x1 >> 1] = (line[x1 >> 1] & 0xF0) | gray;
+        }
+    }
+}
+
+void raster_fill_hline(const RasterTarget *target, int x, int y, int length, uint8_t gray)
+{
+    raster_fill_rect(target, x, y, length, 1, gray);
+}
+
+void raster_draw_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t gray)
+{
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    raster_fill_rect(target, x, y, width, 1, gray);
+    raster_fill_rect(target, x, y + height - 1, width, 1, gray);
+    raster_fill_rect(target, x, y + 1, 1, height - 2, gray);
+    raster_fill_rect(target, x + width - 1, y + 1, 1, height - 2, gray);
+}
+
+static inline void blend_glyph_byte(uint8_t *dst, uint8_t src, const uint8_t *color_lut, bool opaque)
+{
+    uint8_t value = color_lut[src & 0xF] | (color_lut[src >> 4] << 4);
+    if (opaque) {
+        *dst = value;
+        return;
+    }
+
+    uint8_t mask = ((src & 0x0F) ? 0x0F : 0) | ((src & 0xF0) ? 0xF0 : 0);
+    *dst = (*dst & ~mask) | (value & mask);
+}
+
+static inline void blend_glyph_nibble(uint8_t *dst, int high, uint8_t src, const uint8_t *color_lut, bool opaque)
+{
+    if (!opaque && !src) {
+        return;
+    }
+    if (high) {
+        *dst = (*dst & 0x0F) | (color_lut[src] << 4);
+    } else {
+        *dst = (*dst & 0xF0) | color_lut[src];
+    }
+}
+
+void raster_blend_glyph(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *bitmap, const uint8_t *color_lut, bool opaque)
+{
+    if (target->rotation) {
+        RotatedSource source = {
+            .data = bitmap,
+            .width = width,
+            .color_lut = color_lut,
+            .opaque = opaque,
+            .fetch = fetch_glyph
+        };
+        blit_rotated(target, x, y, width, height, &source);
+        return;
+    }
+
+    int x0, y0, x1, y1;
+    if (!clip_area(target, x, y, width, height, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    int stride = (width + 1) / 2;
+
+    for (int row = y0; row < y1; row++) {
+        const uint8_t *src = bitmap + (row - y) * stride;
+        uint8_t *dst = target->framebuffer + row * RASTER_LINE_BYTES + x0 / 2;
+        int px = x0;
+        int sx = x0 - x;
+
+        if (px & 1) {
+            uint8_t value = (src[sx / 2] >> ((sx & 1) * 4)) & 0xF;
+            blend_glyph_nibble(dst, 1, value, color_lut, opaque);
+            dst++;
+            px++;
+            sx++;
+        }
+
+        if ((sx & 1) == 0) {
+            // glyph and framebuffer nibbles line up, one source byte per destination byte
+            const uint8_t *s = src + sx / 2;
+            while (px + 2 <= x1) {
+                if (!opaque && px + 8 <= x1 && !(s[0] | s[1] | s[2] | s[3])) {
+                    // skip blank runs without touching the framebuffer
+                    s += 4;
+                    dst += 4;
+                    px += 8;
+                    continue;
+                }
+                blend_glyph_byte(dst, *s, color_lut, opaque);
+                s++;
+                dst++;
+                px += 2;
+            }
+        } else {
+            const uint8_t *s = src + sx / 2;
+            while (px + 2 <= x1) {
+                blend_glyph_byte(dst, (s[0] >> 4) | (s[1] << 4), color_lut, opaque);
+                s++;
+                dst++;
+                px += 2;
+            }
+        }
+        sx = px - x;
+
+        if (px < x1) {
+            uint8_t value = (src[sx / 2] >> ((sx & 1) * 4)) & 0xF;
+            blend_glyph_nibble(dst, 0, value, color_lut, opaque);
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef _RASTER_H_
+#define _RASTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <epd_driver.h>
+
+#define RASTER_LINE_BYTES (EPD_WIDTH / 2)
+
+/**
+ * A 4bpp epdiy framebuffer together with the area that may be written.
+ *
+ * Even pixels are stored in the low nibble, odd pixels in the high nibble.
+ *
+ * Drawing coordinates are rotated clockwise by rotation degrees (0, 90, 180
+ * or 270) before reaching the framebuffer, the clip rect is not rotated.
+ * Rotated images and glyphs are converted in small tiles, so that both the
+ * source and the framebuffer are walked row by row.
+ */
+typedef struct
+{
+    uint8_t *framebuffer;
+    EpdRect clip;
+    int rotation;
+} RasterTarget;
+
+// 8 bit luma to 4 bit panel gray level, see raster_init
+extern uint8_t raster_gray_lut[256];
+
+/**
+ * Rec. 709 luma rounded to the nearest integer, in fixed point.
+ */
+inline static uint8_t luma_rec709(uint8_t r, uint8_t g, uint8_t b)
+{
+    return (2126u * r + 7152u * g + 722u * b + 5000u) / 10000u;
+}
+
+/**
+ * Gray level (0-15) used on the panel for a given color.
+ */
+inline static uint8_t gray4(uint8_t r, uint8_t g, uint8_t b)
+{
+    return raster_gray_lut[luma_rec709(r, g, b)];
+}
+
+/**
+ * Build the lookup tables used by the raster functions. A gamma of 1.0
+ * maps luma linearly to gray levels, other values apply a panel gamma
+ * curve before quantizing to 4 bits.
+ */
+void raster_init(float gamma);
+
+void raster_target_init(RasterTarget *target, uint8_t *framebuffer);
+
+/**
+ * The framebuffer area covered by rect once rotated by rotation degrees.
+ */
+EpdRect raster_rotate_rect(int rotation, EpdRect rect);
+
+/**
+ * Draw a rgba8888 image, fully transparent pixels are drawn white.
+ */
+void raster_blit_rgba8888(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data);
+
+/**
+ * Draw a packed 4bpp image using the framebuffer layout, each row starts
+ * on a byte boundary. Rows are copied as they are when x is even.
+ */
+void raster_blit_gray4(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data);
+
+/**
+ * Draw a 8 bit grayscale image.
+ */
+void raster_blit_gray8(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *data);
+
+/**
+ * Draw a 8 pixel wide 1bpp glyph, such as the built-in 8x16 font: each
+ * byte of rows is a line with the leftmost pixel in the most significant
+ * bit. Unset pixels are left untouched when bgcolor is negative, otherwise
+ * they are filled with bgcolor.
+ */
+void raster_draw_mono8_glyph(const RasterTarget *target, int x, int y, const uint8_t *rows, int height,
+    uint8_t color, int bgcolor);
+
+/**
+ * Draw a single pixel with a gray level (0-15), if it is inside the clip rect.
+ */
+void raster_draw_pixel(const RasterTarget *target, int x, int y, uint8_t gray);
+
+/**
+ * Fill a rectangle with a gray level (0-15). Whole bytes are written with
+ * memset, only a pixel on an odd left or right edge is merged.
+ */
+void raster_fill_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t gray);
+
+/**
+ * Fill a horizontal line of length pixels starting at (x, y).
+ */
+void raster_fill_hline(const RasterTarget *target, int x, int y, int length, uint8_t gray);
+
+/**
+ * Draw the 1 pixel wide outline of a rectangle.
+ */
+void raster_draw_rect(const RasterTarget *target, int x, int y, int width, int height, uint8_t gray);
+
+/**
+ * Draw a 4bpp anti-aliased glyph bitmap (rows padded to whole bytes, left
+ * pixel in the low nibble), mapping each value through color_lut. Pixels
+ * with value 0 are skipped unless opaque is set.
+ */
+void raster_blend_glyph(const RasterTarget *target, int x, int y, int width, int height,
+    const uint8_t *bitmap, const uint8_t *color_lut, bool opaque);
+
+#endif
@@ -0,0 +1,172 @@
+#include "refresh.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <freertos/task.h>
+
+
+#define REFRESH_TASK_STACK_SIZE 4096
+#define REFRESH_TASK_PRIORITY 5
+
+// Whether every pixel of area in the 4bpp framebuffer is either black or white
+static bool is_black_white(const uint8_t *framebuffer, EpdRect area)
+{
+    int first_byte = area.x / 2;
+    int end_byte = (area.x + area.width + 1) / 2;
+
+    for (int y = area.y; y < area.y + area.height; y++) {
+        const uint8_t *line = framebuffer + y * (EPD_WIDTH / 2);
+        for (int i = first_byte; i < end_byte; i++) {
+            // 0x0 and 0xF are the only nibbles whose bits are all the same
+            if ((line[i] ^ (line[i] >> 1)) & 0x77) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static enum EpdDrawMode select_mode(enum RefreshMode mode, const uint8_t *framebuffer, EpdRect area)
+{
+    switch (mode) {
+        case REFRESH_MODE_DU:
+            return MODE_DU;
+        case REFRESH_MODE_GL16:
+            return MODE_GL16;
+        case REFRESH_MODE_GC16:
+            return MODE_GC16;
+        default:
+            return is_black_white(framebuffer, area) ? MODE_DU : MODE_GL16;
+    }
+}
+
+// Whether one more fast refresh of area would exhaust the ghosting budget of one of its tiles
+static bool over_ghosting_budget(const RefreshWorker *worker, EpdRect area)
+{
+    if (worker->ghosting_budget <= 0) {
+        return false;
+    }
+
+    for (int ty = area.y / REFRESH_TILE_SIZE; ty <= (area.y + area.height - 1) / REFRESH_TILE_SIZE; ty++) {
+        for (int tx = area.x / REFRESH_TILE_SIZE; tx <= (area.x + area.width - 1) / REFRESH_TILE_SIZE; tx++) {
+            if (worker->ghosting[ty][tx] >= worker->ghosting_budget) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void count_fast_refresh(RefreshWorker *worker, EpdRect area)
+{
+    for (int ty = area.y / REFRESH_TILE_SIZE; ty <= (area.y + area.height - 1) / REFRESH_TILE_SIZE; ty++) {
+        for (int tx = area.x / REFRESH_TILE_SIZE; tx <= (area.x + area.width - 1) / REFRESH_TILE_SIZE; tx++) {
+            if (worker->ghosting[ty][tx] < UINT8_MAX) {
+                worker->ghosting[ty][tx]++;
+            }
+        }
+    }
+}
+
+static void refresh_task(void *arg)
+{
+    RefreshWorker *worker = arg;
+    EpdiyHighlevelState *hl = worker->hl;
+
+    for (;;) {
+        // keep the panel powered for a while, refreshes often come in bursts
+        TickType_t wait = worker->power.on ? pdMS_TO_TICKS(worker->power.idle_timeout_ms) : portMAX_DELAY;
+        if (xSemaphoreTake(worker->start, wait) != pdTRUE) {
+            panel_power_off(&worker->power);
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+
+        DamageList damage;
+        damage_init(&damage);
+        for (int i = 0; i < worker->areas_to_scan.count; i++) {
+            damage_scan_area(&damage, hl->front_fb, hl->back_fb, EPD_WIDTH, worker->areas_to_scan.rects[i]);
+        }
+
+        enum EpdDrawMode modes[DAMAGE_MAX_RECTS];
+        bool clean = false;
+        for (int i = 0; i < damage.count; i++) {
+            modes[i] = select_mode(worker->mode, hl->front_fb, damage.rects[i]);
+            if (modes[i] != MODE_GC16 && over_ghosting_budget(worker, damage.rects[i])) {
+                clean = true;
+            }
+        }
+
+        if (damage.count > 0) {
+            panel_power_on(&worker->power);
+            int temperature = panel_power_temperature(&worker->power);
+            if (clean) {
+                // the panel is white after epd_clear, so GC16 only has to draw the rest
+                epd_clear();
+                memset(hl->back_fb, 0xFF, EPD_WIDTH / 2 * EPD_HEIGHT);
+                epd_hl_update_screen(hl, MODE_GC16, temperature);
+                memset(worker->ghosting, 0, sizeof(worker->ghosting));
+            } else {
+                for (int i = 0; i < damage.count; i++) {
+                    epd_hl_update_area(hl, modes[i], temperature, damage.rects[i]);
+                    if (modes[i] != MODE_GC16) {
+                        count_fast_refresh(worker, damage.rects[i]);
+                    }
+                }
+            }
+            if (worker->power.idle_timeout_ms == 0) {
+                panel_power_off(&worker->power);
+            }
+        }
+
+        worker->areas = damage.count;
+        worker->clean = clean;
+        worker->refresh_us = esp_timer_get_time() - start;
+        worker->power_ons = worker->power.power_ons;
+        worker->powered_ms = panel_power_powered_us(&worker->power) / 1000;
+
+        xQueueSend(worker->done_queue, &worker->done_event, portMAX_DELAY);
+    }
+}
+
+bool refresh_worker_start(RefreshWorker *worker, EpdiyHighlevelState *hl, QueueHandle_t done_queue,
+    void *done_event)
+{
+    worker->hl = hl;
+    worker->done_queue = done_queue;
+    worker->done_event = done_event;
+    worker->mode = REFRESH_MODE_AUTO;
+    worker->ghosting_budget = REFRESH_DEFAULT_GHOSTING_BUDGET;
+    memset(worker->ghosting, 0, sizeof(worker->ghosting));
+    worker->refresh_us = 0;
+    worker->areas = 0;
+    worker->clean = false;
+    worker->power_ons = worker->power.power_ons;
+    worker->powered_ms = panel_power_powered_us(&worker->power) / 1000;
+
+    worker->start = xSemaphoreCreateBinary();
+    if (worker->start == NULL) {
+        fprintf(stderr, "failed to create refresh semaphore.\n");
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(refresh_task, "epd_refresh", REFRESH_TASK_STACK_SIZE, worker,
+            REFRESH_TASK_PRIORITY, NULL, tskNO_AFFINITY) != pdPASS) {
+        fprintf(stderr, "failed to create refresh task.\n");
+        return false;
+    }
+
+    return true;
+}
+
+void refresh_worker_submit(RefreshWorker *worker, enum RefreshMode mode, const DamageList *areas)
+{
+    worker->mode = mode;
+    worker->areas_to_scan = *areas;
+    xSemaphoreGive(worker->start);
+}
@@ -0,0 +1,86 @@
+#ifndef _REFRESH_H_
+#define _REFRESH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <epd_highlevel.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include "damage.h"
+#include "power.h"
+
+#define REFRESH_TILE_SIZE 64
+#define REFRESH_TILES_X ((EPD_WIDTH + REFRESH_TILE_SIZE - 1) / REFRESH_TILE_SIZE)
+#define REFRESH_TILES_Y ((EPD_HEIGHT + REFRESH_TILE_SIZE - 1) / REFRESH_TILE_SIZE)
+
+#define REFRESH_DEFAULT_GHOSTING_BUDGET 20
+
+/**
+ * Waveform used for the damaged areas. REFRESH_MODE_AUTO uses DU for areas
+ * that are only black and white and GL16 for the others.
+ */
+enum RefreshMode
+{
+    REFRESH_MODE_AUTO,
+    REFRESH_MODE_DU,
+    REFRESH_MODE_GL16,
+    REFRESH_MODE_GC16
+};
+
+/**
+ * Pushes the highlevel state front buffer to the panel from a dedicated
+ * task, so that the waveform does not block the caller.
+ *
+ * Only one refresh runs at a time. The front buffer must not be written
+ * between refresh_worker_submit() and the completion event.
+ *
+ * Fast waveforms (DU and GL16) leave some ghosting, so the number of fast
+ * refreshes is counted for each REFRESH_TILE_SIZE tile. When a refresh
+ * would go over ghosting_budget on a tile, the whole screen is cleared and
+ * redrawn with GC16 instead. A budget of 0 never forces a clean refresh.
+ *
+ * The worker task owns power once started: the panel stays on while
+ * refreshes keep coming and is turned off after power.idle_timeout_ms
+ * without any.
+ */
+typedef struct
+{
+    EpdiyHighlevelState *hl;
+    SemaphoreHandle_t start;
+    QueueHandle_t done_queue;
+    void *done_event;
+    enum RefreshMode mode;
+    // areas of the front buffer that might differ from the panel
+    DamageList areas_to_scan;
+    int ghosting_budget;
+    uint8_t ghosting[REFRESH_TILES_Y][REFRESH_TILES_X];
+    PanelPower power;
+
+    // results of the last refresh, written before done_event is posted
+    uint32_t refresh_us;
+    // damaged areas found, and whether the ghosting budget forced a full GC16 instead
+    int areas;
+    bool clean;
+    uint32_t power_ons;
+    uint32_t powered_ms;
+} RefreshWorker;
+
+/**
+ * Start the worker task. Once a refresh is done, done_event is sent to
+ * done_queue. worker->power must have been initialized with
+ * panel_power_init(), the panel may be left on.
+ */
+bool refresh_worker_start(RefreshWorker *worker, EpdiyHighlevelState *hl, QueueHandle_t done_queue,
+    void *done_event);
+
+/**
+ * Refresh the parts of areas where the front buffer differs from what is on
+ * the panel.
+ */
+void refresh_worker_submit(RefreshWorker *worker, enum RefreshMode mode, const DamageList *areas);
+
+#endif
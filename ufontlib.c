@@ -1,12 +1,25 @@
 #include "ufontlib.h"
+#ifdef ESP_PLATFORM
 #if ESP_IDF_VERSION < (4, 0, 0) || ARDUINO_ARCH_ESP32
 #include "rom/miniz.h"
 #else
 #include "esp32/rom/miniz.h"
 #endif
+#else
+// off-device builds use the regular miniz distribution
+#include <miniz.h>
+#endif
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#include <sdkconfig.h>
+#endif
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 typedef struct
@@ -32,11 +45,96 @@ static utf_t *utf[] = {
     &(utf_t){ 0 },
 };
 
+#define GET_LIST_ENTRY(list_item, type, list_head_member) \
+    ((type *) (((char *) (list_item)) - ((unsigned long) &((type *) 0)->list_head_member)))
+
+#define LIST_FOR_EACH(item, head) \
+    for (item = (head)->next; item != (head); item = item->next)
+
+#define MUTABLE_LIST_FOR_EACH(item, tmp, head) \
+    for (item = (head)->next, tmp = item->next; item != (head); item = tmp, tmp = item->next)
+
+struct UFListHead;
+
+struct UFListHead
+{
+    struct UFListHead *next;
+    struct UFListHead *prev;
+};
+
+static inline void uflist_insert(struct UFListHead *new_item, struct UFListHead *prev_head, struct UFListHead *next_head)
+{
+    new_item->prev = prev_head;
+    new_item->next = next_head;
+    next_head->prev = new_item;
+    prev_head->next = new_item;
+}
+
+static inline void uflist_append(struct UFListHead *head, struct UFListHead *new_item)
+{
+    uflist_insert(new_item, head->prev, head);
+}
+
+static inline void uflist_remove(struct UFListHead *remove_item)
+{
+    remove_item->prev->next = remove_item->next;
+    remove_item->next->prev = remove_item->prev;
+}
+
+static inline void uflist_init(struct UFListHead *list_item)
+{
+    list_item->prev = list_item;
+    list_item->next = list_item;
+}
+
 /**
  * static decompressor object for compressed fonts.
  */
 static tinfl_decompressor decomp;
 
+static UFontStats total_stats;
+
+/**
+ * Text can be drawn from several threads at once (e.g. one per framebuffer
+ * band). This lock protects the decompressor, the caches and total_stats.
+ * Cache entries that are being drawn from are pinned so that they are not
+ * evicted meanwhile: pins are only taken with the lock held, but released
+ * without it. Each call counts into its own UFontStats, added to
+ * total_stats once at the end.
+ */
+static pthread_mutex_t ufont_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define GLYPH_CACHE_BUCKETS 128
+
+/**
+ * Decompressed glyph bitmap, kept in the glyph cache.
+ *
+ * Entries are keyed by glyph rather than by (font, code point): the glyph
+ * pointer is unique across fonts, and code points resolved to the fallback
+ * glyph share a single entry.
+ */
+struct GlyphCacheEntry
+{
+    struct UFListHead lru_head;
+    struct GlyphCacheEntry *bucket_next;
+    const UFontGlyph *glyph;
+    size_t size;
+    atomic_int pins;
+    uint8_t bitmap[];
+};
+
+/**
+ * LRU cache of decompressed glyphs, bounded by the total size of the entries.
+ */
+static struct
+{
+    struct UFListHead lru;
+    struct GlyphCacheEntry *buckets[GLYPH_CACHE_BUCKETS];
+    size_t used;
+    size_t budget;
+    bool initialized;
+} glyph_cache = { .budget = UFONT_GLYPH_CACHE_DEFAULT_SIZE };
+
 static inline int min(int x, int y) { return x < y ? x : y; }
 static inline int max(int x, int y) { return x > y ? x : y; }
 
@@ -82,21 +180,34 @@ UFontFontProperties ufont_font_properties_default()
     return props;
 }
 
-const UFontGlyph *ufont_get_glyph(const UFontData *font, uint32_t code_point)
+static const UFontGlyph *find_glyph_in_intervals(const UFontData *font, uint32_t code_point)
 {
+    // intervals are sorted and do not overlap
     const UFontUnicodeInterval *intervals = font->intervals;
-    for (unsigned int i = 0; i < font->interval_count; i++) {
-        const UFontUnicodeInterval *interval = &intervals[i];
-        if (code_point >= interval->first && code_point <= interval->last) {
-            return &font->glyph[interval->offset + (code_point - interval->first)];
-        }
+    unsigned int low = 0;
+    unsigned int high = font->interval_count;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        const UFontUnicodeInterval *interval = &intervals[mid];
         if (code_point < interval->first) {
-            return NULL;
+            high = mid;
+        } else if (code_point > interval->last) {
+            low = mid + 1;
+        } else {
+            return &font->glyph[interval->offset + (code_point - interval->first)];
         }
     }
     return NULL;
 }
 
+const UFontGlyph *ufont_get_glyph(const UFontData *font, uint32_t code_point)
+{
+    if (code_point < UFONT_LATIN1_SIZE && font->latin1) {
+        return font->latin1[code_point];
+    }
+    return find_glyph_in_intervals(font, code_point);
+}
+
 static int do_uncompress(uint8_t *dest, size_t uncompressed_size, const uint8_t *source, size_t source_size)
 {
     if (uncompressed_size == 0 || dest == NULL || source_size == 0 || source == NULL) {
@@ -112,79 +223,197 @@ static int do_uncompress(uint8_t *dest, size_t uncompressed_size, const uint8_t
     return 0;
 }
 
-/*!
-   @brief   Draw a single character to a pre-allocated buffer.
-*/
-static enum UFontDrawError draw_char(const UFontData *font, void *buffer,
-    int *cursor_x, int cursor_y, uint32_t cp,
-    const UFontFontProperties *props)
+static inline unsigned int glyph_cache_bucket(const UFontGlyph *glyph)
 {
+    return ((uintptr_t) glyph / sizeof(UFontGlyph)) % GLYPH_CACHE_BUCKETS;
+}
 
-    assert(props != NULL);
+static void *glyph_cache_alloc(size_t size)
+{
+#if defined(ESP_PLATFORM) && (CONFIG_SPIRAM_SUPPORT || CONFIG_SPIRAM)
+    // prefer PSRAM for the bulk of cached bitmaps and keep internal RAM for everything else
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr) {
+        return ptr;
+    }
+#endif
+    return malloc(size);
+}
 
-    const UFontGlyph *glyph = ufont_get_glyph(font, cp);
-    if (!glyph) {
-        glyph = ufont_get_glyph(font, props->fallback_glyph);
+static void glyph_cache_init()
+{
+    uflist_init(&glyph_cache.lru);
+    memset(glyph_cache.buckets, 0, sizeof(glyph_cache.buckets));
+    glyph_cache.used = 0;
+    glyph_cache.initialized = true;
+}
+
+// Evict the least recently used entry that is not pinned, returns false when there is none
+static bool glyph_cache_evict_lru()
+{
+    struct UFListHead *item = glyph_cache.lru.prev;
+    while (item != &glyph_cache.lru
+        && GET_LIST_ENTRY(item, struct GlyphCacheEntry, lru_head)->pins > 0) {
+        item = item->prev;
     }
+    if (item == &glyph_cache.lru) {
+        return false;
+    }
+    struct GlyphCacheEntry *entry = GET_LIST_ENTRY(item, struct GlyphCacheEntry, lru_head);
 
-    if (!glyph) {
-        return UFONT_DRAW_GLYPH_FALLBACK_FAILED;
+    struct GlyphCacheEntry **link = &glyph_cache.buckets[glyph_cache_bucket(entry->glyph)];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
     }
+    *link = entry->bucket_next;
 
-    uint32_t offset = glyph->data_offset;
-    uint16_t width = glyph->width, height = glyph->height;
-    int left = glyph->left;
+    uflist_remove(&entry->lru_head);
+    glyph_cache.used -= entry->size;
+    free(entry);
+    return true;
+}
 
-    int byte_width = (width / 2 + width % 2);
-    unsigned long bitmap_size = byte_width * height;
-    const uint8_t *bitmap = NULL;
-    if (font->compressed) {
-        uint8_t *tmp_bitmap = (uint8_t *) malloc(bitmap_size);
-        if (tmp_bitmap == NULL && bitmap_size) {
+static struct GlyphCacheEntry *glyph_cache_lookup(const UFontGlyph *glyph)
+{
+    struct GlyphCacheEntry *entry = glyph_cache.buckets[glyph_cache_bucket(glyph)];
+    while (entry && entry->glyph != glyph) {
+        entry = entry->bucket_next;
+    }
+    return entry;
+}
+
+static void glyph_cache_insert(struct GlyphCacheEntry *entry)
+{
+    while (glyph_cache.used + entry->size > glyph_cache.budget && glyph_cache_evict_lru()) {
+    }
+
+    unsigned int bucket = glyph_cache_bucket(entry->glyph);
+    entry->bucket_next = glyph_cache.buckets[bucket];
+    glyph_cache.buckets[bucket] = entry;
+    uflist_insert(&entry->lru_head, &glyph_cache.lru, glyph_cache.lru.next);
+    glyph_cache.used += entry->size;
+}
+
+void ufont_glyph_cache_set_size(size_t bytes)
+{
+    pthread_mutex_lock(&ufont_mutex);
+    if (!glyph_cache.initialized) {
+        glyph_cache_init();
+    }
+    glyph_cache.budget = bytes;
+    while (glyph_cache.used > glyph_cache.budget && glyph_cache_evict_lru()) {
+    }
+    pthread_mutex_unlock(&ufont_mutex);
+}
+
+/**
+ * Get the decompressed bitmap of a compressed glyph, either from the cache
+ * or by decompressing it. Bitmaps that do not fit in the cache are returned
+ * in *to_free and have to be released by the caller, bitmaps from the cache
+ * are pinned in *pinned until the caller unpins them.
+ * Must be called with ufont_mutex held.
+ */
+static const uint8_t *get_compressed_glyph_bitmap(const UFontData *font, const UFontGlyph *glyph,
+    size_t bitmap_size, uint8_t **to_free, struct GlyphCacheEntry **pinned, UFontStats *stats)
+{
+    *to_free = NULL;
+    *pinned = NULL;
+
+    if (!glyph_cache.initialized) {
+        glyph_cache_init();
+    }
+
+    struct GlyphCacheEntry *entry = glyph_cache_lookup(glyph);
+    if (entry) {
+        // move to the front of the LRU list
+        uflist_remove(&entry->lru_head);
+        uflist_insert(&entry->lru_head, &glyph_cache.lru, glyph_cache.lru.next);
+        stats->glyph_cache_hits++;
+        entry->pins++;
+        *pinned = entry;
+        return entry->bitmap;
+    }
+    stats->glyph_cache_misses++;
+
+    size_t entry_size = sizeof(struct GlyphCacheEntry) + bitmap_size;
+    bool cacheable = entry_size <= glyph_cache.budget;
+
+    uint8_t *bitmap;
+    if (cacheable) {
+        entry = glyph_cache_alloc(entry_size);
+        if (entry == NULL) {
             fprintf(stderr, "malloc failed.");
-            return UFONT_DRAW_FAILED_ALLOC;
+            return NULL;
         }
-        do_uncompress(tmp_bitmap, bitmap_size, &font->bitmap[offset],
-            glyph->compressed_size);
-        bitmap = tmp_bitmap;
+        entry->glyph = glyph;
+        entry->size = entry_size;
+        entry->pins = 0;
+        bitmap = entry->bitmap;
     } else {
-        bitmap = &font->bitmap[offset];
+        bitmap = malloc(bitmap_size);
+        if (bitmap == NULL) {
+            fprintf(stderr, "malloc failed.");
+            return NULL;
+        }
+        *to_free = bitmap;
     }
+    stats->allocs++;
 
-    uint8_t color_lut[16];
-    for (int c = 0; c < 16; c++) {
-        int color_difference = (int) props->fg_color - (int) props->bg_color;
-        color_lut[c] = max(0, min(15, props->bg_color + c * color_difference / 15));
+    if (do_uncompress(bitmap, bitmap_size, &font->bitmap[glyph->data_offset], glyph->compressed_size)) {
+        // draw nothing rather than garbage, and try again next time
+        memset(bitmap, 0, bitmap_size);
+        if (cacheable) {
+            *to_free = (uint8_t *) entry;
+        }
+        return bitmap;
     }
-    bool background_needed = props->flags & UFONT_DRAW_BACKGROUND;
 
-    for (int y = 0; y < height; y++) {
-        int yy = cursor_y - glyph->top + y;
-        int start_pos = *cursor_x + left;
-        bool byte_complete = start_pos % 2;
-        int x = max(0, -start_pos);
-        int max_x = start_pos + width;
-        uint8_t color;
-
-        for (int xx = start_pos; xx < max_x; xx++) {
-            uint8_t bm = bitmap[y * byte_width + x / 2];
-            if ((x & 1) == 0) {
-                bm = bm & 0xF;
-            } else {
-                bm = bm >> 4;
-            }
-            if (background_needed || bm) {
-                color = color_lut[bm] << 4;
-                ufont_draw_pixel(xx, yy, color, buffer);
+    if (cacheable) {
+        glyph_cache_insert(entry);
+        entry->pins++;
+        *pinned = entry;
+    }
+
+    return bitmap;
+}
+
+/*!
+   @brief   Draw a single, already resolved, glyph to a pre-allocated buffer.
+*/
+static enum UFontDrawError draw_glyph(const UFontData *font, void *buffer,
+    const UFontGlyph *glyph, int cursor_x, int cursor_y,
+    const uint8_t *color_lut, bool background_needed, UFontStats *stats)
+{
+    uint16_t width = glyph->width, height = glyph->height;
+
+    int byte_width = (width / 2 + width % 2);
+    unsigned long bitmap_size = byte_width * height;
+
+    uint8_t *to_free = NULL;
+    struct GlyphCacheEntry *pinned = NULL;
+    if (bitmap_size > 0) {
+        const uint8_t *bitmap = NULL;
+        if (font->compressed) {
+            pthread_mutex_lock(&ufont_mutex);
+            bitmap = get_compressed_glyph_bitmap(font, glyph, bitmap_size, &to_free, &pinned, stats);
+            pthread_mutex_unlock(&ufont_mutex);
+            if (bitmap == NULL) {
+                return UFONT_DRAW_FAILED_ALLOC;
             }
-            byte_complete = !byte_complete;
-            x++;
+        } else {
+            bitmap = &font->bitmap[glyph->data_offset];
         }
+
+        ufont_draw_bitmap(cursor_x + glyph->left, cursor_y - glyph->top, width, height, bitmap,
+            color_lut, background_needed, buffer);
     }
-    if (font->compressed) {
-        free((uint8_t *) bitmap);
+
+    if (pinned) {
+        pinned->pins--;
     }
-    *cursor_x += glyph->advance_x;
+    stats->glyphs_drawn++;
+
+    free(to_free);
     return UFONT_DRAW_SUCCESS;
 }
 
@@ -290,80 +519,447 @@ void ufont_get_text_bounds(const UFontData *font, const char *string,
     *h = maxy - miny;
 }
 
-static enum UFontDrawError ufont_write_line(
-    const UFontData *font, const char *string, int *cursor_x,
-    int *cursor_y, void *framebuffer,
-    const UFontFontProperties *properties)
+/**
+ * A glyph of a laid out line, at a pen position relative to the line start.
+ */
+typedef struct
 {
+    const UFontGlyph *glyph;
+    int x;
+} LayoutGlyph;
 
-    assert(framebuffer != NULL);
+/**
+ * A line decoded once into resolved glyphs, with its bounds relative to
+ * the line start (x) and the base line (y).
+ */
+typedef struct
+{
+    LayoutGlyph *glyphs;
+    int count;
+    int capacity;
+    int advance;
+    int minx, miny, maxx, maxy;
+    enum UFontDrawError err;
+    // glyphs was allocated by layout_reserve
+    bool heap_glyphs;
+} LayoutRun;
+
+#define LAYOUT_SCRATCH_SIZE 128
 
-    if (*string == '\0') {
-        return UFONT_DRAW_SUCCESS;
+/**
+ * Storage for a line that is not in the layout cache, kept by the caller so
+ * that lines can be laid out by several threads. Only grown on the heap for
+ * unusually long lines.
+ */
+typedef struct
+{
+    LayoutRun run;
+    LayoutGlyph storage[LAYOUT_SCRATCH_SIZE];
+} LayoutScratch;
+
+static void layout_scratch_init(LayoutScratch *scratch)
+{
+    scratch->run.glyphs = scratch->storage;
+    scratch->run.count = 0;
+    scratch->run.capacity = LAYOUT_SCRATCH_SIZE;
+    scratch->run.heap_glyphs = false;
+}
+
+static void layout_scratch_destroy(LayoutScratch *scratch)
+{
+    if (scratch->run.heap_glyphs) {
+        free(scratch->run.glyphs);
     }
+}
 
-    assert(properties != NULL);
-    UFontFontProperties props = *properties;
-    enum UFontFontFlags alignment_mask = UFONT_DRAW_ALIGN_LEFT | UFONT_DRAW_ALIGN_RIGHT | UFONT_DRAW_ALIGN_CENTER;
-    enum UFontFontFlags alignment = props.flags & alignment_mask;
+#define LAYOUT_CACHE_BUCKETS 64
+
+/**
+ * A laid out line kept across draw calls. Layout only depends on the
+ * font, the text, the fallback glyph and whether the background is part
+ * of the bounds, so colors and alignment are not part of the key.
+ */
+struct LayoutCacheEntry
+{
+    struct UFListHead lru_head;
+    struct LayoutCacheEntry *bucket_next;
+    const UFontData *font;
+    uint32_t hash;
+    uint32_t fallback_glyph;
+    bool background;
+    int length;
+    size_t size;
+    atomic_int pins;
+    LayoutRun run;
+    const char *text;
+    LayoutGlyph glyphs[];
+};
 
-    // alignments are mutually exclusive!
-    if ((alignment & (alignment - 1)) != 0) {
-        return UFONT_DRAW_INVALID_FONT_FLAGS;
+/**
+ * LRU cache of laid out lines, bounded by the total size of the entries.
+ */
+static struct
+{
+    struct UFListHead lru;
+    struct LayoutCacheEntry *buckets[LAYOUT_CACHE_BUCKETS];
+    size_t used;
+    size_t budget;
+    bool initialized;
+} layout_cache = { .budget = UFONT_LAYOUT_CACHE_DEFAULT_SIZE };
+
+static void layout_cache_init()
+{
+    uflist_init(&layout_cache.lru);
+    memset(layout_cache.buckets, 0, sizeof(layout_cache.buckets));
+    layout_cache.used = 0;
+    layout_cache.initialized = true;
+}
+
+// Evict the least recently used entry that is not pinned, returns false when there is none
+static bool layout_cache_evict_lru()
+{
+    struct UFListHead *item = layout_cache.lru.prev;
+    while (item != &layout_cache.lru
+        && GET_LIST_ENTRY(item, struct LayoutCacheEntry, lru_head)->pins > 0) {
+        item = item->prev;
     }
+    if (item == &layout_cache.lru) {
+        return false;
+    }
+    struct LayoutCacheEntry *entry = GET_LIST_ENTRY(item, struct LayoutCacheEntry, lru_head);
 
-    int x1 = 0, y1 = 0, w = 0, h = 0;
-    int tmp_cur_x = *cursor_x;
-    int tmp_cur_y = *cursor_y;
-    ufont_get_text_bounds(font, string, &tmp_cur_x, &tmp_cur_y, &x1, &y1, &w, &h, &props);
+    struct LayoutCacheEntry **link = &layout_cache.buckets[entry->hash % LAYOUT_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
 
-    // no printable characters
-    if (w < 0 || h < 0) {
-        return UFONT_DRAW_NO_DRAWABLE_CHARACTERS;
+    uflist_remove(&entry->lru_head);
+    layout_cache.used -= entry->size;
+    free(entry);
+    return true;
+}
+
+void ufont_layout_cache_set_size(size_t bytes)
+{
+    pthread_mutex_lock(&ufont_mutex);
+    if (!layout_cache.initialized) {
+        layout_cache_init();
+    }
+    layout_cache.budget = bytes;
+    while (layout_cache.used > layout_cache.budget && layout_cache_evict_lru()) {
+    }
+    pthread_mutex_unlock(&ufont_mutex);
+}
+
+// FNV-1a
+static uint32_t hash_text(const char *string, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t) string[i]) * 16777619u;
     }
+    return hash;
+}
 
-    int local_cursor_x = *cursor_x;
-    int local_cursor_y = *cursor_y;
-    uint32_t c;
+static bool layout_reserve(LayoutRun *run, int count, UFontStats *stats)
+{
+    if (count <= run->capacity) {
+        return true;
+    }
 
-    int cursor_x_init = local_cursor_x;
-    int cursor_y_init = local_cursor_y;
+    int capacity = run->capacity * 2;
+    while (capacity < count) {
+        capacity *= 2;
+    }
 
-    switch (alignment) {
-        case UFONT_DRAW_ALIGN_LEFT: {
-            break;
+    LayoutGlyph *glyphs;
+    if (!run->heap_glyphs) {
+        glyphs = malloc(capacity * sizeof(LayoutGlyph));
+        if (glyphs) {
+            memcpy(glyphs, run->glyphs, run->count * sizeof(LayoutGlyph));
         }
-        case UFONT_DRAW_ALIGN_CENTER: {
-            local_cursor_x -= w / 2;
+    } else {
+        glyphs = realloc(run->glyphs, capacity * sizeof(LayoutGlyph));
+    }
+    if (glyphs == NULL) {
+        return false;
+    }
+    stats->allocs++;
+
+    run->glyphs = glyphs;
+    run->capacity = capacity;
+    run->heap_glyphs = true;
+    return true;
+}
+
+/*!
+ * @brief Decode the line in [string, end) and resolve its glyphs into run.
+ */
+static void layout_line(const UFontData *font, const char *string, const char *end,
+    const UFontFontProperties *props, LayoutRun *run, UFontStats *stats)
+{
+    run->count = 0;
+    run->advance = 0;
+    run->minx = INT_MAX;
+    run->miny = INT_MAX;
+    run->maxx = INT_MIN;
+    run->maxy = INT_MIN;
+    run->err = UFONT_DRAW_SUCCESS;
+
+    bool background = props->flags & UFONT_DRAW_BACKGROUND;
+
+    const uint8_t *p = (const uint8_t *) string;
+    while (p < (const uint8_t *) end) {
+        uint32_t c = next_cp(&p);
+        if (c == 0) {
             break;
         }
-        case UFONT_DRAW_ALIGN_RIGHT: {
-            local_cursor_x -= w;
+
+        const UFontGlyph *glyph = ufont_get_glyph(font, c);
+        if (!glyph) {
+            glyph = ufont_get_glyph(font, props->fallback_glyph);
+        }
+        if (!glyph) {
+            run->err |= UFONT_DRAW_GLYPH_FALLBACK_FAILED;
+            continue;
+        }
+
+        if (!layout_reserve(run, run->count + 1, stats)) {
+            run->err |= UFONT_DRAW_FAILED_ALLOC;
+            return;
+        }
+        run->glyphs[run->count].glyph = glyph;
+        run->glyphs[run->count].x = run->advance;
+        run->count++;
+
+        // same bounds as get_char_bounds
+        int x = run->advance;
+        int x1 = x + glyph->left, y1 = glyph->top - glyph->height,
+            x2 = x1 + glyph->width, y2 = y1 + glyph->height;
+        if (background) {
+            run->minx = min(x, min(run->minx, x1));
+            run->maxx = max(max(x + glyph->advance_x, x2), run->maxx);
+            run->miny = min(font->descender, min(run->miny, y1));
+            run->maxy = max(font->ascender, max(run->maxy, y2));
+        } else {
+            run->minx = min(run->minx, x1);
+            run->miny = min(run->miny, y1);
+            run->maxx = max(run->maxx, x2);
+            run->maxy = max(run->maxy, y2);
+        }
+
+        run->advance += glyph->advance_x;
+    }
+}
+
+/*!
+ * @brief Get the layout of the line in [string, end), from the layout cache
+ * when possible, otherwise it is laid out in scratch. A run from the cache
+ * is pinned in *pinned until the caller unpins it.
+ * Must be called with ufont_mutex held.
+ */
+static const LayoutRun *layout_line_cached(const UFontData *font, const char *string, const char *end,
+    const UFontFontProperties *props, LayoutScratch *scratch, struct LayoutCacheEntry **pinned,
+    UFontStats *stats)
+{
+    *pinned = NULL;
+
+    if (!layout_cache.initialized) {
+        layout_cache_init();
+    }
+
+    int length = end - string;
+    uint32_t hash = hash_text(string, length);
+    bool background = props->flags & UFONT_DRAW_BACKGROUND;
+
+    struct LayoutCacheEntry *entry = layout_cache.buckets[hash % LAYOUT_CACHE_BUCKETS];
+    while (entry) {
+        if (entry->hash == hash && entry->font == font && entry->length == length
+            && entry->fallback_glyph == props->fallback_glyph && entry->background == background
+            && !memcmp(entry->text, string, length)) {
             break;
         }
+        entry = entry->bucket_next;
+    }
+
+    if (entry) {
+        uflist_remove(&entry->lru_head);
+        uflist_insert(&entry->lru_head, &layout_cache.lru, layout_cache.lru.next);
+        stats->layout_cache_hits++;
+        entry->pins++;
+        *pinned = entry;
+        return &entry->run;
+    }
+    stats->layout_cache_misses++;
+
+    LayoutRun *run = &scratch->run;
+    layout_line(font, string, end, props, run, stats);
+    if (run->err & UFONT_DRAW_FAILED_ALLOC) {
+        return run;
+    }
+
+    size_t glyphs_size = run->count * sizeof(LayoutGlyph);
+    size_t entry_size = sizeof(struct LayoutCacheEntry) + glyphs_size + length;
+    if (entry_size > layout_cache.budget) {
+        return run;
+    }
+
+    entry = malloc(entry_size);
+    if (entry == NULL) {
+        return run;
+    }
+    stats->allocs++;
+
+    while (layout_cache.used + entry_size > layout_cache.budget && layout_cache_evict_lru()) {
+    }
+
+    entry->font = font;
+    entry->hash = hash;
+    entry->fallback_glyph = props->fallback_glyph;
+    entry->background = background;
+    entry->length = length;
+    entry->size = entry_size;
+    entry->pins = 1;
+    entry->run = *run;
+    entry->run.glyphs = entry->glyphs;
+    entry->run.capacity = run->count;
+    entry->run.heap_glyphs = false;
+    memcpy(entry->glyphs, run->glyphs, glyphs_size);
+    char *text = (char *) entry->glyphs + glyphs_size;
+    memcpy(text, string, length);
+    entry->text = text;
+
+    struct LayoutCacheEntry **bucket = &layout_cache.buckets[hash % LAYOUT_CACHE_BUCKETS];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    uflist_insert(&entry->lru_head, &layout_cache.lru, layout_cache.lru.next);
+    layout_cache.used += entry_size;
+
+    *pinned = entry;
+    return &entry->run;
+}
+
+// Where a laid out line starts when the cursor is at cursor_x, according to the alignment.
+static int aligned_line_x(const LayoutRun *run, int cursor_x, const UFontFontProperties *props)
+{
+    int w = run->maxx - min(0, run->minx);
+
+    switch (props->flags & (UFONT_DRAW_ALIGN_LEFT | UFONT_DRAW_ALIGN_RIGHT | UFONT_DRAW_ALIGN_CENTER)) {
+        case UFONT_DRAW_ALIGN_CENTER:
+            return cursor_x - w / 2;
+        case UFONT_DRAW_ALIGN_RIGHT:
+            return cursor_x - w;
         default:
-            break;
+            return cursor_x;
+    }
+}
+
+/*!
+ * @brief Draw a laid out line, aligned according to the font properties.
+ */
+static enum UFontDrawError draw_line(const UFontData *font, const LayoutRun *run,
+    int *cursor_x, int cursor_y, void *framebuffer,
+    const UFontFontProperties *props, UFontStats *stats)
+{
+    // no printable characters
+    if (run->count == 0) {
+        return run->err | UFONT_DRAW_NO_DRAWABLE_CHARACTERS;
     }
 
-    //FIXME: needed from ufont_draw_hline
-    //uint8_t bg = props.bg_color;
-    if (props.flags & UFONT_DRAW_BACKGROUND) {
-        for (int l = local_cursor_y - font->ascender;
-             l < local_cursor_y - font->descender; l++) {
-            //FIXME: following function is not implemented
-            //ufont_draw_hline(local_cursor_x, l, w, bg << 4, framebuffer);
+    int w = run->maxx - min(0, run->minx);
+    int line_x = aligned_line_x(run, *cursor_x, props);
+
+    if (props->flags & UFONT_DRAW_BACKGROUND) {
+        uint8_t bg = props->bg_color;
+        int bg_x = line_x + min(0, run->minx);
+        for (int l = cursor_y - font->ascender;
+             l < cursor_y - font->descender; l++) {
+            ufont_draw_hline(bg_x, l, w, bg << 4, framebuffer);
         }
     }
-    enum UFontDrawError err = UFONT_DRAW_SUCCESS;
-    while ((c = next_cp((const uint8_t **) &string))) {
-        err |= draw_char(font, framebuffer, &local_cursor_x, local_cursor_y, c, &props);
+
+    uint8_t color_lut[16];
+    int color_difference = (int) props->fg_color - (int) props->bg_color;
+    for (int c = 0; c < 16; c++) {
+        color_lut[c] = max(0, min(15, props->bg_color + c * color_difference / 15));
+    }
+    bool background_needed = props->flags & UFONT_DRAW_BACKGROUND;
+
+    enum UFontDrawError err = run->err;
+    for (int i = 0; i < run->count; i++) {
+        err |= draw_glyph(font, framebuffer, run->glyphs[i].glyph, line_x + run->glyphs[i].x, cursor_y,
+            color_lut, background_needed, stats);
     }
 
-    *cursor_x += local_cursor_x - cursor_x_init;
-    *cursor_y += local_cursor_y - cursor_y_init;
+    *cursor_x = line_x + run->advance;
     return err;
 }
 
+// Must be called with ufont_mutex held.
+static void add_to_total_stats(const UFontStats *stats)
+{
+    total_stats.glyphs_drawn += stats->glyphs_drawn;
+    total_stats.allocs += stats->allocs;
+    total_stats.glyph_cache_hits += stats->glyph_cache_hits;
+    total_stats.glyph_cache_misses += stats->glyph_cache_misses;
+    total_stats.layout_cache_hits += stats->layout_cache_hits;
+    total_stats.layout_cache_misses += stats->layout_cache_misses;
+}
+
+UFontRect ufont_get_draw_rect(const UFontData *font, const char *string, int x, int y,
+    const UFontFontProperties *properties)
+{
+    assert(properties != NULL);
+
+    UFontStats stats;
+    memset(&stats, 0, sizeof(stats));
+    LayoutScratch scratch;
+    layout_scratch_init(&scratch);
+
+    int minx = INT_MAX, miny = INT_MAX, maxx = INT_MIN, maxy = INT_MIN;
+    const char *line = string;
+    pthread_mutex_lock(&ufont_mutex);
+    while (line) {
+        const char *end = strchr(line, '\n');
+        if (end == NULL) {
+            end = line + strlen(line);
+        }
+
+        if (end != line) {
+            struct LayoutCacheEntry *pinned;
+            const LayoutRun *run = layout_line_cached(font, line, end, properties, &scratch, &pinned, &stats);
+            if (run->count > 0) {
+                int line_x = aligned_line_x(run, x, properties);
+                minx = min(minx, line_x + run->minx);
+                maxx = max(maxx, line_x + run->maxx);
+                // layout bounds grow upwards from the base line
+                miny = min(miny, y - run->maxy);
+                maxy = max(maxy, y - run->miny);
+            }
+            if (pinned) {
+                pinned->pins--;
+            }
+        }
+        y += font->advance_y;
+
+        line = *end ? end + 1 : NULL;
+    }
+    add_to_total_stats(&stats);
+    pthread_mutex_unlock(&ufont_mutex);
+
+    layout_scratch_destroy(&scratch);
+
+    UFontRect rect = { .x = x, .y = y, .width = 0, .height = 0 };
+    if (minx < maxx && miny < maxy) {
+        rect.x = minx;
+        rect.y = miny;
+        rect.width = maxx - minx;
+        rect.height = maxy - miny;
+    }
+    return rect;
+}
+
 enum UFontDrawError ufont_write_default(const UFontData *font, const char *string, int *cursor_x,
     int *cursor_y, void *framebuffer)
 {
@@ -376,30 +972,91 @@ enum UFontDrawError ufont_write_string(
     int *cursor_y, void *framebuffer,
     const UFontFontProperties *properties)
 {
-    char *token, *newstring, *tofree;
+    UFontStats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    enum UFontDrawError err = ufont_write_string_with_stats(font, string, cursor_x, cursor_y, framebuffer,
+        properties, &stats);
+
+    pthread_mutex_lock(&ufont_mutex);
+    add_to_total_stats(&stats);
+    pthread_mutex_unlock(&ufont_mutex);
+
+    return err;
+}
+
+enum UFontDrawError ufont_write_string_with_stats(
+    const UFontData *font, const char *string, int *cursor_x,
+    int *cursor_y, void *framebuffer,
+    const UFontFontProperties *properties, UFontStats *stats)
+{
     if (string == NULL) {
         fprintf(stderr, "cannot draw a NULL string!");
         return UFONT_DRAW_STRING_INVALID;
     }
-    tofree = newstring = strdup(string);
-    if (newstring == NULL) {
-        fprintf(stderr, "cannot allocate string copy!");
-        return UFONT_DRAW_FAILED_ALLOC;
-    }
+
+    assert(framebuffer != NULL);
+    assert(properties != NULL);
+
+    enum UFontFontFlags alignment_mask = UFONT_DRAW_ALIGN_LEFT | UFONT_DRAW_ALIGN_RIGHT | UFONT_DRAW_ALIGN_CENTER;
+    enum UFontFontFlags alignment = properties->flags & alignment_mask;
+
+    LayoutScratch scratch;
+    layout_scratch_init(&scratch);
 
     enum UFontDrawError err = UFONT_DRAW_SUCCESS;
-    // taken from the strsep manpage
     int line_start = *cursor_x;
-    while ((token = strsep(&newstring, "\n")) != NULL) {
+    const char *line = string;
+    while (true) {
+        const char *end = strchr(line, '\n');
+        if (end == NULL) {
+            end = line + strlen(line);
+        }
+
         *cursor_x = line_start;
-        err |= ufont_write_line(font, token, cursor_x, cursor_y, framebuffer, properties);
+        if (end != line) {
+            // alignments are mutually exclusive!
+            if ((alignment & (alignment - 1)) != 0) {
+                err |= UFONT_DRAW_INVALID_FONT_FLAGS;
+            } else {
+                struct LayoutCacheEntry *pinned;
+                pthread_mutex_lock(&ufont_mutex);
+                const LayoutRun *run = layout_line_cached(font, line, end, properties, &scratch, &pinned, stats);
+                pthread_mutex_unlock(&ufont_mutex);
+
+                err |= draw_line(font, run, cursor_x, *cursor_y, framebuffer, properties, stats);
+
+                if (pinned) {
+                    pinned->pins--;
+                }
+            }
+        }
         *cursor_y += font->advance_y;
+
+        if (*end == '\0') {
+            break;
+        }
+        line = end + 1;
     }
 
-    free(tofree);
+    layout_scratch_destroy(&scratch);
     return err;
 }
 
+void ufont_get_stats(UFontStats *out)
+{
+    pthread_mutex_lock(&ufont_mutex);
+    *out = total_stats;
+    pthread_mutex_unlock(&ufont_mutex);
+}
+
+void ufont_reset_stats()
+{
+    pthread_mutex_lock(&ufont_mutex);
+    memset(&total_stats, 0, sizeof(total_stats));
+    pthread_mutex_unlock(&ufont_mutex);
+}
+
 UFontData *ufont_load_font(const void *ufont, const void *glyph, const void *intervals, const void *bitmap)
 {
     struct __attribute__((__packed__))
@@ -414,6 +1071,7 @@ UFontData *ufont_load_font(const void *ufont, const void *glyph, const void *int
     memcpy(&serialized_ufont, ufont, sizeof(serialized_ufont));
 
     UFontData *loaded_font = malloc(sizeof(UFontData));
+    loaded_font->latin1 = NULL;
     loaded_font->bitmap = bitmap;
     loaded_font->glyph = glyph;
     loaded_font->intervals = intervals;
@@ -423,77 +1081,73 @@ UFontData *ufont_load_font(const void *ufont, const void *glyph, const void *int
     loaded_font->ascender = serialized_ufont.ascender;
     loaded_font->descender = serialized_ufont.descender;
 
-    return loaded_font;
-}
-
-#define GET_LIST_ENTRY(list_item, type, list_head_member) \
-    ((type *) (((char *) (list_item)) - ((unsigned long) &((type *) 0)->list_head_member)))
-
-#define LIST_FOR_EACH(item, head) \
-    for (item = (head)->next; item != (head); item = item->next)
-
-#define MUTABLE_LIST_FOR_EACH(item, tmp, head) \
-    for (item = (head)->next, tmp = item->next; item != (head); item = tmp, tmp = item->next)
-
-struct UFListHead;
-
-struct UFListHead
-{
-    struct UFListHead *next;
-    struct UFListHead *prev;
-};
-
-static inline void uflist_insert(struct UFListHead *new_item, struct UFListHead *prev_head, struct UFListHead *next_head)
-{
-    new_item->prev = prev_head;
-    new_item->next = next_head;
-    next_head->prev = new_item;
-    prev_head->next = new_item;
-}
+    // without the table lookups just fall back to the intervals
+    const UFontGlyph **latin1 = malloc(sizeof(UFontGlyph *) * UFONT_LATIN1_SIZE);
+    if (latin1) {
+        for (uint32_t code_point = 0; code_point < UFONT_LATIN1_SIZE; code_point++) {
+            latin1[code_point] = find_glyph_in_intervals(loaded_font, code_point);
+        }
+    }
+    loaded_font->latin1 = latin1;
 
-static inline void uflist_append(struct UFListHead *head, struct UFListHead *new_item)
-{
-    uflist_insert(new_item, head->prev, head);
+    return loaded_font;
 }
 
-static inline void uflist_remove(struct UFListHead *remove_item)
-{
-    remove_item->prev->next = remove_item->next;
-    remove_item->next->prev = remove_item->prev;
-}
+#define UFONT_MANAGER_BUCKETS 32
 
-static inline void uflist_init(struct UFListHead *list_item)
-{
-    list_item->prev = list_item;
-    list_item->next = list_item;
-}
+typedef struct UFont UFont;
 
-typedef struct
+struct UFont
 {
     struct UFListHead list_head;
+    UFont *bucket_next;
     const char *handle;
+    uint32_t id;
     UFontData *font;
-} UFont;
+};
 
 struct UFontManager
 {
     struct UFListHead font_list;
+    UFont *buckets[UFONT_MANAGER_BUCKETS];
 };
 
 UFontManager *ufont_manager_new()
 {
     UFontManager *ufont_manager = malloc(sizeof(UFontManager));
     uflist_init(&ufont_manager->font_list);
+    memset(ufont_manager->buckets, 0, sizeof(ufont_manager->buckets));
 
     return ufont_manager;
 }
 
-void ufont_manager_register(UFontManager *ufont_manager, const char *handle, UFontData *font)
+static UFont *ufont_manager_add(UFontManager *ufont_manager, const char *handle, uint32_t id, UFontData *font)
 {
     UFont *ufont = malloc(sizeof(UFont));
+    ufont->bucket_next = NULL;
     ufont->handle = strdup(handle);
+    ufont->id = id;
     ufont->font = font;
     uflist_append(&ufont_manager->font_list, &ufont->list_head);
+
+    return ufont;
+}
+
+void ufont_manager_register(UFontManager *ufont_manager, const char *handle, UFontData *font)
+{
+    ufont_manager_add(ufont_manager, handle, UFONT_MANAGER_NO_ID, font);
+}
+
+void ufont_manager_register_with_id(UFontManager *ufont_manager, const char *handle, uint32_t id, UFontData *font)
+{
+    UFont *ufont = ufont_manager_add(ufont_manager, handle, id, font);
+
+    // append, so that like with handles the first registered font wins
+    UFont **link = &ufont_manager->buckets[id % UFONT_MANAGER_BUCKETS];
+    while (*link) {
+        link = &(*link)->bucket_next;
+    }
+    *link = ufont;
 }
 
 UFontData *ufont_manager_find_by_handle(UFontManager *ufont_manager, const char *handle)
@@ -509,6 +1163,19 @@ UFontData *ufont_manager_find_by_handle(UFontManager *ufont_manager, const char
     return NULL;
 }
 
+UFontData *ufont_manager_find_by_id(UFontManager *ufont_manager, uint32_t id)
+{
+    UFont *ufont = ufont_manager->buckets[id % UFONT_MANAGER_BUCKETS];
+    while (ufont) {
+        if (ufont->id == id) {
+            return ufont->font;
+        }
+        ufont = ufont->bucket_next;
+    }
+
+    return NULL;
+}
+
 #ifdef __ORDER_LITTLE_ENDIAN__
     #ifdef __GNUC__
         #define UF_ENDIAN_SWAP_32(value) __builtin_bswap32(value)
@@ -4,8 +4,22 @@ extern "C" {
 
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#ifndef UFONT_LAYOUT_CACHE_DEFAULT_SIZE
+/// Default byte budget of the text layout cache.
+#define UFONT_LAYOUT_CACHE_DEFAULT_SIZE 8192
+#endif
+
+/// Code points looked up through a direct table instead of the intervals.
+#define UFONT_LATIN1_SIZE 256
+
+#ifndef UFONT_GLYPH_CACHE_DEFAULT_SIZE
+/// Default byte budget of the decompressed glyph cache.
+#define UFONT_GLYPH_CACHE_DEFAULT_SIZE 16384
+#endif
+
 /// Font data stored PER GLYPH
 typedef struct __attribute__((__packed__)) {
   uint16_t width;            ///< Bitmap dimensions in pixels
@@ -34,6 +48,7 @@ typedef struct {
   uint16_t advance_y;         ///< Newline distance (y axis)
   int ascender;               ///< Maximal height of a glyph above the base line
   int descender;              ///< Maximal height of a glyph below the base line
+  const UFontGlyph **latin1;  ///< Glyphs for code points below UFONT_LATIN1_SIZE, built at load time
 } UFontData;
 
 /// An area on the display.
@@ -95,6 +110,22 @@ typedef struct {
   enum UFontFontFlags flags;
 } UFontFontProperties;
 
+/// Rendering counters, reset with ufont_reset_stats().
+typedef struct {
+  /// Glyphs drawn to a framebuffer.
+  uint32_t glyphs_drawn;
+  /// Heap allocations done while drawing (e.g. glyph decompression buffers).
+  uint32_t allocs;
+  /// Compressed glyphs found in the glyph cache.
+  uint32_t glyph_cache_hits;
+  /// Compressed glyphs that had to be decompressed.
+  uint32_t glyph_cache_misses;
+  /// Lines whose layout was found in the layout cache.
+  uint32_t layout_cache_hits;
+  /// Lines that had to be laid out.
+  uint32_t layout_cache_misses;
+} UFontStats;
+
 /**
  * Draw a pixel a given framebuffer.
  *
@@ -105,6 +136,21 @@ typedef struct {
  */
 void ufont_draw_pixel(int x, int y, uint8_t color, void *framebuffer);
 
+/**
+ * Draw a 4bpp glyph bitmap to a given framebuffer.
+ *
+ * @param x: Horizontal position of the left edge in pixels.
+ * @param y: Vertical position of the top edge in pixels.
+ * @param width: Bitmap width in pixels, rows are padded to whole bytes.
+ * @param height: Bitmap height in pixels.
+ * @param bitmap: Two pixels per byte, the left one in the low nibble.
+ * @param color_lut: The gray value (0-15) to draw for each bitmap value.
+ * @param opaque: Also draw pixels whose bitmap value is 0.
+ * @param framebuffer: The framebuffer to draw to,
+ */
+void ufont_draw_bitmap(int x, int y, int width, int height, const uint8_t *bitmap,
+                    const uint8_t *color_lut, bool opaque, void *framebuffer);
+
 /**
  * Draw a horizontal line to a given framebuffer.
  *
@@ -144,6 +190,14 @@ void ufont_get_text_bounds(const UFontData *font, const char *string,
 UFontRect ufont_get_string_rect (const UFontData *font, const char *string,
                      int x, int y, int margin, const UFontFontProperties *properties );
 
+/**
+ * Get the area that ufont_write_string() draws to when called with the same
+ * arguments, including the background, alignment and every line.
+ * The width is 0 when nothing would be drawn.
+ */
+UFontRect ufont_get_draw_rect(const UFontData *font, const char *string, int x, int y,
+                     const UFontFontProperties *properties);
+
 /**
  * Write text to the UFONT.
  */
@@ -151,6 +205,14 @@ enum UFontDrawError ufont_write_string(const UFontData *font, const char *string
                 int *cursor_y, void *framebuffer,
                 const UFontFontProperties *properties);
 
+/**
+ * Same as ufont_write_string(), but the counters of this call are added to
+ * stats instead of the ones returned by ufont_get_stats().
+ */
+enum UFontDrawError ufont_write_string_with_stats(const UFontData *font, const char *string,
+                int *cursor_x, int *cursor_y, void *framebuffer,
+                const UFontFontProperties *properties, UFontStats *stats);
+
 /**
  * Write a (multi-line) string to the UFONT.
  */
@@ -168,12 +230,37 @@ UFontData *ufont_load_font(const void *ufont, const void *glyph, const void *int
 struct UFontManager;
 typedef struct UFontManager UFontManager;
 
+/// Id of fonts registered without one.
+#define UFONT_MANAGER_NO_ID UINT32_MAX
+
 UFontManager *ufont_manager_new();
 void ufont_manager_register(UFontManager *ufont_manager, const char *handle, UFontData *font);
 UFontData *ufont_manager_find_by_handle(UFontManager *ufont_manager, const char *handle);
 
+/**
+ * Register a font that can also be found by a numeric id (such as an atom
+ * index) through a hash table, without any string comparison.
+ */
+void ufont_manager_register_with_id(UFontManager *ufont_manager, const char *handle, uint32_t id, UFontData *font);
+UFontData *ufont_manager_find_by_id(UFontManager *ufont_manager, uint32_t id);
+
 UFontData *ufont_parse(const void *iff_binary, int buf_size);
 
+/**
+ * Set the byte budget of the decompressed glyph cache, evicting glyphs
+ * as needed. A budget of 0 disables caching.
+ */
+void ufont_glyph_cache_set_size(size_t bytes);
+
+/**
+ * Set the byte budget of the text layout cache, which keeps decoded and
+ * measured lines across draw calls. A budget of 0 disables caching.
+ */
+void ufont_layout_cache_set_size(size_t bytes);
+
+void ufont_get_stats(UFontStats *stats);
+void ufont_reset_stats();
+
 #ifdef __cplusplus
 }
 #endif